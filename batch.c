@@ -0,0 +1,393 @@
+/*
+ * To build and run: `gcc -O2 batch.c frame.c palette.c kcodec.c tilecache.c checkpoint.c export.c complex.c -lm -lpthread -lz -o batch && ./batch jobs.txt`
+ * (must be done in the root project folder)
+ *
+ * Add -DSINGLE_THREADED to build without worker threads, or -DMAX_K=5000
+ * (say) to allow iteration caps above 1000.
+ *
+ * Renders a batch of images with no window, for machines without a
+ * display. The job file lists one image per line:
+ *
+ *     # x y w columns rows max-k output
+ *     -2.5 -1.25 3.5 3840 2160 1000 whole.png
+ *     -0.7453 0.1127 0.00065 1920 1080 1000 spiral.ppm
+ *
+ * x, y and w are the origin (bottom-left corner) and width, as in the
+ * viewer, max-k is the job's iteration cap, up to the build's MAX_K,
+ * and the output is a PNG, or a PPM for .ppm. Lines starting with #
+ * are ignored.
+ *
+ * One pool of threads works through the whole batch, taking the tiles
+ * of each job in turn: threads that run out of tiles in one job carry
+ * on with the next one rather than waiting for the last tiles of it.
+ * Once a job is rendered, its PNG is deflated a group of rows at a
+ * time by the same threads, which take those groups ahead of tiles so
+ * that images are written out as soon as they can be. The tile cache,
+ * the pool of k buffers and the threads are all set up once for the
+ * batch, and the k values come out the same as in the viewer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "export.h"
+#include "frame.h"
+#include "palette.h"
+#include "tilecache.h"
+
+// Tile cache size when not given (megabytes), as in the viewer.
+#define DEFAULT_TILE_CACHE 256
+
+struct Job {
+    int line;          // In the job file.
+    double x;          // Viewport, as for a Frame.
+    double y;
+    double w;
+    int columns;
+    int rows;
+    short maxK;
+    char *path;
+
+    long firstTile;    // Of the batch's tiles.
+    int tiles;
+    struct Frame *frame; // Allocated by whichever thread gets to it first.
+    atomic_int tilesDone;
+    atomic_int min;
+    atomic_long iterations;
+    atomic_int failed;
+    double start;      // When its first tile was picked up.
+    double rendered;   // When its last tile was done.
+
+    // Writing the PNG, once rendered.
+    unsigned short *index;
+    struct ColorTable *table;
+    struct Deflating *deflating;
+    int nextGroup;     // To deflate, taken under the batch's lock.
+    struct Job *nextWriting;
+};
+
+struct Batch {
+    struct Job *jobs;
+    int jobCount;
+    long tiles;        // Of every job, one after another.
+    atomic_long nextTile;
+    atomic_int jobsDone;
+    atomic_int jobsFailed;
+    int threads;
+    struct Job *writing; // Jobs with groups of rows left to deflate, oldest first.
+#if !defined SINGLE_THREADED
+    pthread_mutex_t lock; // Taken to set up a job, and for writing.
+    pthread_cond_t work;  // Signalled when groups to deflate come up, or a job is done.
+#endif
+};
+
+static void lockBatch(struct Batch *batch) {
+#if !defined SINGLE_THREADED
+    pthread_mutex_lock(&batch->lock);
+#endif
+}
+static void unlockBatch(struct Batch *batch) {
+#if !defined SINGLE_THREADED
+    pthread_mutex_unlock(&batch->lock);
+#endif
+}
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Read the jobs of a job file ("-" for standard
+ * input). Returns the number read, or -1 if the file
+ * cannot be read or a line is not a job.
+ */
+static int readJobs(const char *path, struct Job **jobs) {
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!fp) {
+        printf("Unable to read %s.\n", path);
+        return -1;
+    }
+
+    int count = 0;
+    int capacity = 0;
+    int bad = 0;
+    char line[4352];
+    char output[4096];
+    for (int number = 1; fgets(line, sizeof(line), fp); number++) {
+        char *p = line + strspn(line, " \t\r\n");
+        if (*p == 0 || *p == '#') continue;
+
+        struct Job job;
+        memset(&job, 0, sizeof(job));
+        int maxK;
+        if (sscanf(p, "%lf %lf %lf %d %d %d %4095s", &job.x, &job.y, &job.w, &job.columns, &job.rows, &maxK, output) != 7 ||
+            job.w <= 0 || job.columns < 1 || job.rows < 1) {
+            printf("%s:%d: expected x y w columns rows max-k output.\n", path, number);
+            bad = 1;
+            continue;
+        }
+        if (maxK < 1 || maxK > MAX_K) {
+            printf("%s:%d: max-k is %d, but this build renders up to %d (build with -DMAX_K=%d).\n", path, number, maxK, MAX_K, maxK);
+            bad = 1;
+            continue;
+        }
+        job.maxK = maxK;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            struct Job *grown = realloc(*jobs, capacity * sizeof(struct Job));
+            if (!grown) {
+                bad = 1;
+                break;
+            }
+            *jobs = grown;
+        }
+        job.line = number;
+        job.path = strdup(output);
+        (*jobs)[count++] = job;
+    }
+    if (fp != stdin) fclose(fp);
+    return bad ? -1 : count;
+}
+
+/*
+ * Report a job written (or not), once done with it.
+ */
+static void reportJob(struct Batch *batch, struct Job *job, int result) {
+    double written = seconds();
+    int rendered = job->index != NULL;
+    free(job->index);
+    free(job->table);
+    job->index = NULL;
+    job->table = NULL;
+
+    lockBatch(batch);
+    int done = atomic_fetch_add(&batch->jobsDone, 1) + 1;
+    if (result != 0) {
+        atomic_fetch_add(&batch->jobsFailed, 1);
+        printf("[%d/%d] %s: unable to %s (line %d)\n", done, batch->jobCount, job->path,
+               rendered ? "write" : "render", job->line);
+    } else {
+        double megapixels = (double) job->columns * job->rows / 1e6;
+        printf("[%d/%d] %s  %d x %d  render %.2f s (%.1f MP/s, %.0f M iterations)  write %.2f s\n",
+               done, batch->jobCount, job->path, job->columns, job->rows, job->rendered - job->start,
+               megapixels / (job->rendered - job->start), atomic_load(&job->iterations) / 1e6, written - job->rendered);
+    }
+    fflush(stdout);
+#if !defined SINGLE_THREADED
+    pthread_cond_broadcast(&batch->work);
+#endif
+    unlockBatch(batch);
+}
+
+/*
+ * Color in a rendered job's frame, then write it out
+ * if it is a PPM, or else queue the groups of rows of
+ * its PNG for the batch's threads to deflate. A PNG
+ * is split into as many groups as the batch has
+ * threads, however many are free, so that a job file
+ * run with the same --threads writes the same files.
+ */
+static void finishJob(struct Batch *batch, struct Job *job) {
+    job->rendered = seconds();
+    if (!atomic_load(&job->failed)) {
+        job->index = malloc((size_t) job->columns * job->rows * sizeof(unsigned short));
+        job->table = malloc(sizeof(struct ColorTable));
+    }
+    size_t length = strlen(job->path);
+    int ppm = length > 4 && strcmp(job->path + length - 4, ".ppm") == 0;
+    int result = -1;
+    if (job->index && job->table) {
+        job->table->min = -1;
+        buildColorTable(job->table, atomic_load(&job->min), job->maxK, 0);
+        indexFrame(job->frame, job->index);
+        if (ppm) {
+            result = writePPM(job->path, job->index, job->columns, job->rows, job->table->colors);
+        } else {
+            job->deflating = startPNG(job->index, job->columns, job->rows, job->table->colors, batch->threads);
+        }
+    }
+    discardFrame(job->frame);
+    job->frame = NULL;
+    if (!job->deflating) {
+        reportJob(batch, job, result);
+        return;
+    }
+
+    lockBatch(batch);
+    struct Job **last = &batch->writing;
+    while (*last) last = &(*last)->nextWriting;
+    *last = job;
+#if !defined SINGLE_THREADED
+    pthread_cond_broadcast(&batch->work);
+#endif
+    unlockBatch(batch);
+}
+
+/*
+ * Render (or load) one tile of a job, and finish the
+ * job if it was the last.
+ */
+static void renderJobTile(struct Batch *batch, struct Job *job, int t) {
+    lockBatch(batch);
+    if (t == 0) job->start = seconds();
+    if (!job->frame && !atomic_load(&job->failed)) {
+        job->frame = newFrame(NULL, job->x, job->y, job->w, job->columns, job->rows);
+        if (job->frame) {
+            job->frame->maxK = job->maxK;
+        } else {
+            atomic_store(&job->failed, 1);
+        }
+    }
+    unlockBatch(batch);
+
+    if (!atomic_load(&job->failed)) {
+        int min = MAX_K;
+        long iterations = renderOrLoadTile(job->frame, frameTile(job->frame, t), 1, &min, NULL);
+        int shared = atomic_load(&job->min);
+        while (min < shared && !atomic_compare_exchange_weak(&job->min, &shared, min));
+        atomic_fetch_add(&job->iterations, iterations);
+    }
+
+    if (atomic_fetch_add(&job->tilesDone, 1) + 1 == job->tiles) finishJob(batch, job);
+}
+
+/*
+ * Work through the batch: deflate a group of rows of
+ * a PNG when there is one, or else render a tile, and
+ * wait for more to do once the tiles run out, until
+ * every job is done.
+ */
+static void* runBatch(void *arg) {
+    struct Batch *batch = arg;
+    int j = 0;
+    for (;;) {
+        lockBatch(batch);
+        struct Job *job = batch->writing;
+#if !defined SINGLE_THREADED
+        while (!job && atomic_load(&batch->nextTile) >= batch->tiles && atomic_load(&batch->jobsDone) < batch->jobCount) {
+            pthread_cond_wait(&batch->work, &batch->lock);
+            job = batch->writing;
+        }
+#endif
+        int g = 0;
+        if (job) {
+            g = job->nextGroup++;
+            if (job->nextGroup == job->deflating->groupCount) batch->writing = job->nextWriting;
+        }
+        unlockBatch(batch);
+
+        if (job) {
+            if (deflatePNGGroup(job->deflating, g)) {
+                int result = finishPNG(job->deflating, job->path);
+                job->deflating = NULL;
+                reportJob(batch, job, result);
+            }
+            continue;
+        }
+
+        long tile = atomic_fetch_add(&batch->nextTile, 1);
+        if (tile >= batch->tiles) {
+            if (atomic_load(&batch->jobsDone) == batch->jobCount) return NULL;
+            continue;
+        }
+        // Tiles are handed out in order, so the job only moves on
+        while (tile >= batch->jobs[j].firstTile + batch->jobs[j].tiles) j++;
+        renderJobTile(batch, &batch->jobs[j], tile - batch->jobs[j].firstTile);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct Batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.threads = defaultRenderThreads();
+    long tileCacheSize = DEFAULT_TILE_CACHE;
+    char *tileCacheDirectory = NULL;
+    const char *path = NULL;
+
+    // Read Options
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            batch.threads = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--tile-cache") == 0 && a + 1 < argc) {
+            tileCacheSize = atol(argv[++a]);
+        } else if (strcmp(argv[a], "--tile-cache-dir") == 0 && a + 1 < argc) {
+            tileCacheDirectory = argv[++a];
+        } else if (!path && (strncmp(argv[a], "--", 2) != 0 || strcmp(argv[a], "-") == 0)) {
+            path = argv[a];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (!path) {
+        printf("Usage: %s [--threads count] [--tile-cache megabytes] [--tile-cache-dir directory] jobs.txt\n", argv[0]);
+        printf("  Each line of the job file is x y w columns rows max-k output, output being\n");
+        printf("  a PNG (or a PPM, for .ppm). Use - to read the jobs from standard input.\n");
+        printf("  max-k is the iteration cap, up to %d in this build.\n", MAX_K);
+        printf("  --threads is the threads rendering and compressing the batch, by default one per CPU.\n");
+        printf("  --tile-cache 0 renders every tile instead of keeping them on disk.\n");
+        return 1;
+    }
+    if (batch.threads < 1) batch.threads = 1;
+    if (batch.threads > MAX_THREADS) batch.threads = MAX_THREADS;
+
+    batch.jobCount = readJobs(path, &batch.jobs);
+    if (batch.jobCount < 0) return 1;
+    for (int j = 0; j < batch.jobCount; j++) {
+        struct Job *job = &batch.jobs[j];
+        job->firstTile = batch.tiles;
+        job->tiles = ((job->columns + TILE_SIZE - 1) / TILE_SIZE) * ((job->rows + TILE_SIZE - 1) / TILE_SIZE);
+        batch.tiles += job->tiles;
+        atomic_init(&job->tilesDone, 0);
+        atomic_init(&job->min, MAX_K);
+        atomic_init(&job->iterations, 0);
+        atomic_init(&job->failed, 0);
+    }
+    atomic_init(&batch.nextTile, 0);
+    atomic_init(&batch.jobsDone, 0);
+    atomic_init(&batch.jobsFailed, 0);
+
+    // Open the Tile Cache, carrying on without it if it is unusable
+    if (tileCacheSize > 0) {
+        char *directory = tileCacheDirectory ? strdup(tileCacheDirectory) : defaultTileCacheDirectory();
+        if (directory) tileCache = openTileCache(directory, tileCacheSize * 1024 * 1024);
+        if (!tileCache) printf("Unable to open tile cache%s%s, rendering every tile.\n", directory ? " in " : "", directory ? directory : "");
+        free(directory);
+    }
+
+    // Render
+    printf("%d jobs on %d threads\n", batch.jobCount, batch.threads);
+    double start = seconds();
+#if !defined SINGLE_THREADED
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.work, NULL);
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    for (; started < batch.threads - 1; started++) {
+        if (pthread_create(&workers[started], NULL, runBatch, &batch) != 0) break;
+    }
+    runBatch(&batch); // Lend a hand
+    for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+    pthread_cond_destroy(&batch.work);
+    pthread_mutex_destroy(&batch.lock);
+#else
+    runBatch(&batch);
+#endif
+    double elapsed = seconds() - start;
+
+    struct FramePoolStats pool = framePoolStats();
+    printf("%d of %d jobs written in %.2f s (k buffers: %ld taken, %ld allocated, %ld for another size)\n",
+           batch.jobCount - atomic_load(&batch.jobsFailed), batch.jobCount, elapsed, pool.taken, pool.created, pool.resized);
+    if (tileCache) {
+        printf("Tile cache: %ld hits, %ld misses\n", atomic_load(&tileCache->hits), atomic_load(&tileCache->misses));
+        closeTileCache(tileCache);
+    }
+
+    for (int j = 0; j < batch.jobCount; j++) free(batch.jobs[j].path);
+    free(batch.jobs);
+    return atomic_load(&batch.jobsFailed) ? 1 : 0;
+}
@@ -0,0 +1,281 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC 0x544B4843 // "CHKT"
+
+// Bytes before the k values, so that they start on a page.
+#define PAGE 4096
+
+// What the k values of a render depend on, at the start of the file. Kept
+// free of padding, as it is compared as bytes.
+struct CheckpointKey {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t maxK;
+    uint16_t precision; // Size of the floating point type points are computed in.
+    uint16_t reserved;
+    int32_t columns;
+    int32_t rows;
+    int32_t tileCount;
+    double x;
+    double y;
+    double w;
+};
+
+// States of a tile.
+enum TileState {
+    Pending,   // Not rendered yet.
+    Completed, // Copied into the mapping, but not yet synced to disk.
+    Syncing,   // Being synced to disk.
+    Saved      // On disk, and marked as such.
+};
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static struct CheckpointKey checkpointKey(double x, double y, double w, int columns, int rows, int maxK, int tileCount) {
+    struct CheckpointKey key;
+    memset(&key, 0, sizeof(key));
+    key.magic = CHECKPOINT_MAGIC;
+    key.version = CHECKPOINT_VERSION;
+    key.maxK = maxK;
+    key.precision = sizeof(double);
+    key.columns = columns;
+    key.rows = rows;
+    key.tileCount = tileCount;
+    key.x = x;
+    key.y = y;
+    key.w = w;
+    return key;
+}
+
+static long tableBytes(int tileCount) {
+    return (sizeof(struct CheckpointKey) + tileCount + PAGE - 1) / PAGE * PAGE;
+}
+
+/*
+ * Sync the tiles completed since last time to disk,
+ * then mark them as saved.
+ */
+static void saveTiles(struct Checkpoint *checkpoint) {
+#if !defined SINGLE_THREADED
+    pthread_mutex_lock(&checkpoint->lock);
+#endif
+    int first = checkpoint->tileCount;
+    int last = -1;
+    for (int t = 0; t < checkpoint->tileCount; t++) {
+        unsigned char expected = Completed;
+        if (!atomic_compare_exchange_strong(&checkpoint->states[t], &expected, Syncing)) continue;
+        if (t < first) first = t;
+        last = t;
+    }
+    if (last >= 0) {
+        // Their k values first, so that a tile marked as saved is on disk
+        long tileBytes = TILE_AREA * sizeof(unsigned short);
+        char *from = (char*) checkpoint->k + first * tileBytes;
+        long offset = (from - (char*) checkpoint->mapped) / PAGE * PAGE;
+        long length = (char*) checkpoint->k + (last + 1) * tileBytes - ((char*) checkpoint->mapped + offset);
+        int synced = msync((char*) checkpoint->mapped + offset, length, MS_SYNC) == 0;
+
+        // Then mark them as saved (or try again next time). Tiles
+        // completed while syncing wait for next time
+        long count = 0;
+        for (int t = first; t <= last; t++) {
+            if (atomic_load(&checkpoint->states[t]) != Syncing) continue;
+            if (synced) checkpoint->table[t] = 1;
+            count++;
+        }
+        if (synced) synced = msync(checkpoint->mapped, tableBytes(checkpoint->tileCount), MS_SYNC) == 0;
+        for (int t = first; t <= last; t++) {
+            if (atomic_load(&checkpoint->states[t]) == Syncing) atomic_store(&checkpoint->states[t], synced ? Saved : Completed);
+        }
+        if (synced) atomic_fetch_add(&checkpoint->saved, count);
+    }
+    checkpoint->savedAt = seconds();
+#if !defined SINGLE_THREADED
+    pthread_mutex_unlock(&checkpoint->lock);
+#endif
+}
+
+#if !defined SINGLE_THREADED
+static void* checkpointThread(void *arg) {
+    struct Checkpoint *checkpoint = arg;
+    pthread_mutex_lock(&checkpoint->lock);
+    while (!checkpoint->closing) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += (time_t) CHECKPOINT_INTERVAL;
+        until.tv_nsec += (long) ((CHECKPOINT_INTERVAL - (time_t) CHECKPOINT_INTERVAL) * 1e9);
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&checkpoint->wake, &checkpoint->lock, &until);
+        if (checkpoint->closing) break;
+        pthread_mutex_unlock(&checkpoint->lock);
+        saveTiles(checkpoint);
+        pthread_mutex_lock(&checkpoint->lock);
+    }
+    pthread_mutex_unlock(&checkpoint->lock);
+    return NULL;
+}
+#endif
+
+/*
+ * Open the checkpoint file of a render of the given
+ * viewport and iteration cap, creating it, or carrying
+ * on with the tiles saved in it if it is of the same
+ * render.
+ * Returns NULL if the file cannot be used.
+ */
+struct Checkpoint* openCheckpoint(const char *path, double x, double y, double w, int columns, int rows, int maxK) {
+    struct Checkpoint *checkpoint = calloc(1, sizeof(struct Checkpoint));
+    if (!checkpoint) return NULL;
+    int tileColumns = (columns + TILE_SIZE - 1) / TILE_SIZE;
+    int tileRows = (rows + TILE_SIZE - 1) / TILE_SIZE;
+    checkpoint->tileCount = tileColumns * tileRows;
+    checkpoint->x = x;
+    checkpoint->y = y;
+    checkpoint->w = w;
+    checkpoint->columns = columns;
+    checkpoint->rows = rows;
+    checkpoint->maxK = maxK;
+    checkpoint->size = tableBytes(checkpoint->tileCount) + frameBytes(columns, rows);
+    checkpoint->path = strdup(path);
+    checkpoint->states = calloc(checkpoint->tileCount, sizeof(atomic_uchar));
+    checkpoint->file = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (!checkpoint->path || !checkpoint->states || checkpoint->file < 0) {
+        if (checkpoint->file >= 0) close(checkpoint->file);
+        free(checkpoint->path);
+        free(checkpoint->states);
+        free(checkpoint);
+        return NULL;
+    }
+
+    // Start over unless the file is of the same render
+    struct CheckpointKey key = checkpointKey(x, y, w, columns, rows, maxK, checkpoint->tileCount);
+    struct CheckpointKey found;
+    struct stat status;
+    int same = fstat(checkpoint->file, &status) == 0 && status.st_size == checkpoint->size &&
+               pread(checkpoint->file, &found, sizeof(found), 0) == sizeof(found) &&
+               memcmp(&found, &key, sizeof(key)) == 0;
+    if (!same && (ftruncate(checkpoint->file, 0) != 0 || ftruncate(checkpoint->file, checkpoint->size) != 0 ||
+                  pwrite(checkpoint->file, &key, sizeof(key), 0) != sizeof(key) || fdatasync(checkpoint->file) != 0)) {
+        checkpoint->mapped = MAP_FAILED;
+    } else {
+        checkpoint->mapped = mmap(NULL, checkpoint->size, PROT_READ | PROT_WRITE, MAP_SHARED, checkpoint->file, 0);
+    }
+    if (checkpoint->mapped == MAP_FAILED) {
+        close(checkpoint->file);
+        free(checkpoint->path);
+        free(checkpoint->states);
+        free(checkpoint);
+        return NULL;
+    }
+    checkpoint->table = (uint8_t*) checkpoint->mapped + sizeof(struct CheckpointKey);
+    checkpoint->k = (unsigned short*) ((char*) checkpoint->mapped + tableBytes(checkpoint->tileCount));
+    long saved = 0;
+    for (int t = 0; t < checkpoint->tileCount; t++) {
+        atomic_init(&checkpoint->states[t], checkpoint->table[t] ? Saved : Pending);
+        saved += checkpoint->table[t] != 0;
+    }
+    atomic_init(&checkpoint->restored, 0);
+    atomic_init(&checkpoint->saved, saved);
+    checkpoint->savedAt = seconds();
+
+#if !defined SINGLE_THREADED
+    pthread_mutex_init(&checkpoint->lock, NULL);
+    pthread_cond_init(&checkpoint->wake, NULL);
+    checkpoint->started = pthread_create(&checkpoint->thread, NULL, checkpointThread, checkpoint) == 0;
+#endif
+    return checkpoint;
+}
+
+/*
+ * Save the tiles still to be saved and close the
+ * checkpoint. The file is deleted if every tile of
+ * the render is saved.
+ */
+void closeCheckpoint(struct Checkpoint *checkpoint) {
+#if !defined SINGLE_THREADED
+    if (checkpoint->started) {
+        pthread_mutex_lock(&checkpoint->lock);
+        checkpoint->closing = 1;
+        pthread_cond_signal(&checkpoint->wake);
+        pthread_mutex_unlock(&checkpoint->lock);
+        pthread_join(checkpoint->thread, NULL);
+    }
+#endif
+    saveTiles(checkpoint);
+    int done = atomic_load(&checkpoint->saved) == checkpoint->tileCount;
+
+    munmap(checkpoint->mapped, checkpoint->size);
+    close(checkpoint->file);
+    if (done) unlink(checkpoint->path);
+#if !defined SINGLE_THREADED
+    pthread_mutex_destroy(&checkpoint->lock);
+    pthread_cond_destroy(&checkpoint->wake);
+#endif
+    free(checkpoint->path);
+    free(checkpoint->states);
+    free(checkpoint);
+}
+
+// The tile of the render a tile of a frame is, or -1 if the frame is of another viewport or cap.
+static int checkpointTile(struct Checkpoint *checkpoint, struct Frame *frame, struct Tile tile) {
+    if (frame->x != checkpoint->x || frame->y != checkpoint->y || frame->w != checkpoint->w ||
+        frame->columns != checkpoint->columns || frame->rows != checkpoint->rows || frame->maxK != checkpoint->maxK) {
+        return -1;
+    }
+    return tile.y / TILE_SIZE * frame->tileColumns + tile.x / TILE_SIZE;
+}
+
+/*
+ * Load a tile from the checkpoint if it was saved,
+ * folding its k values into min. Returns 0, or -1 if
+ * it was not (or the frame is of another render).
+ */
+int loadCheckpointTile(struct Checkpoint *checkpoint, struct Frame *frame, struct Tile tile, int *min) {
+    int t = checkpointTile(checkpoint, frame, tile);
+    if (t < 0 || atomic_load(&checkpoint->states[t]) != Saved) return -1;
+
+    const unsigned short *k = checkpoint->k + (size_t) t * TILE_AREA;
+    memcpy(FRAME_TILE(frame, t), k, TILE_AREA * sizeof(unsigned short));
+    int lowest = *min;
+    for (int i = 0; i < tile.h; i++) {
+        for (int r = 0; r < tile.w; r++) {
+            if (k[i*TILE_SIZE + r] < lowest) lowest = k[i*TILE_SIZE + r];
+        }
+    }
+    *min = lowest;
+    atomic_fetch_add(&checkpoint->restored, 1);
+    return 0;
+}
+
+/*
+ * Copy a fully rendered tile of a frame into the
+ * checkpoint, to be saved by the next pass of the
+ * background thread (or by this call, without one).
+ */
+void saveCheckpointTile(struct Checkpoint *checkpoint, struct Frame *frame, struct Tile tile) {
+    int t = checkpointTile(checkpoint, frame, tile);
+    if (t < 0 || atomic_load(&checkpoint->states[t]) != Pending) return;
+
+    memcpy(checkpoint->k + (size_t) t * TILE_AREA, FRAME_TILE(frame, t), TILE_AREA * sizeof(unsigned short));
+    atomic_store(&checkpoint->states[t], Completed);
+#if !defined SINGLE_THREADED
+    if (checkpoint->started) return;
+#endif
+    if (seconds() - checkpoint->savedAt >= CHECKPOINT_INTERVAL) saveTiles(checkpoint);
+}
@@ -0,0 +1,72 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdatomic.h>
+
+#include "frame.h"
+
+/*
+ * Checkpoints
+ *
+ * Keeps the k values of one long render on disk as
+ * its tiles complete, so that if the process is
+ * stopped part way, rendering the same viewport
+ * again picks up from the tiles saved, and ends up
+ * with the same k values as if it had never stopped.
+ *
+ * The file is mapped, and a completed tile is only
+ * copied into it; a background thread saves the
+ * tiles completed since it last looked every so
+ * often, syncing their k values to disk before
+ * marking them as saved in the file's table of
+ * tiles. A tile marked as saved is then always on
+ * disk in full. Once every tile is saved, the render
+ * is done and the file is deleted when closed.
+ *
+ * Tiles are the unit of work: at most 64 x 64 points
+ * of up to MAX_K iterations each, they take well
+ * under a second, so no progress within a tile is
+ * kept.
+ */
+
+// Bumped whenever the formula or the file layout changes.
+#define CHECKPOINT_VERSION 1
+
+// Time between saving the tiles completed (seconds).
+#define CHECKPOINT_INTERVAL 2.0
+
+struct Checkpoint {
+    char *path;
+    int file;
+    void *mapped;      // The whole file.
+    long size;
+    uint8_t *table;    // Saved flag of each tile, in the mapping.
+    unsigned short *k; // K values of each tile, in the mapping.
+
+    double x;          // Viewport of the render, as for a Frame.
+    double y;
+    double w;
+    int columns;
+    int rows;
+    int maxK;          // Iteration cap of the render.
+    int tileCount;
+    atomic_uchar *states; // Of each tile (see checkpoint.c).
+    double savedAt;       // When tiles were last saved.
+
+    atomic_long restored; // Tiles loaded from an earlier run.
+    atomic_long saved;    // Tiles saved by this run.
+#if !defined SINGLE_THREADED
+    pthread_mutex_t lock; // Taken while saving.
+    pthread_cond_t wake;
+    pthread_t thread;
+    int started;          // Whether thread is running.
+    int closing;
+#endif
+};
+
+struct Checkpoint* openCheckpoint(const char*, double, double, double, int, int, int);
+void closeCheckpoint(struct Checkpoint*);
+int loadCheckpointTile(struct Checkpoint*, struct Frame*, struct Tile, int*);
+void saveCheckpointTile(struct Checkpoint*, struct Frame*, struct Tile);
+
+#endif
@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <zlib.h>
+
+#include "export.h"
+#include "palette.h"
+
+// Rows of the image deflated together, at least.
+#define GROUP_ROWS 16
+
+// Groups per thread, so that threads that finish early can pick up more.
+#define GROUPS_PER_THREAD 4
+
+// Rows filtered at a time, before being handed to deflate.
+#define SLICE_ROWS 8
+
+// Compression level; the bands compress well even at the fastest.
+#define PNG_LEVEL 1
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void putBE32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+// Color in a row of an index image as RGB.
+static void colorRow(const unsigned short *row, int width, const uint32_t *table, uint8_t *out) {
+    for (int r = 0; r < width; r++, out += 3) {
+        uint32_t color = table[row[r]];
+        out[0] = color >> 24;
+        out[1] = color >> 16;
+        out[2] = color >> 8;
+    }
+}
+
+/*
+ * Write an index image colored in through a color
+ * table, as a PNG or PPM depending on the name of the
+ * file. Returns 0, or -1.
+ */
+int writeImage(const char *path, const unsigned short *index, int width, int height, const uint32_t *table, int threads) {
+    size_t length = strlen(path);
+    if (length > 4 && strcmp(path + length - 4, ".ppm") == 0) {
+        return writePPM(path, index, width, height, table);
+    }
+    return writePNG(path, index, width, height, table, threads);
+}
+
+int writePPM(const char *path, const unsigned short *index, int width, int height, const uint32_t *table) {
+    FILE *fp = fopen(path, "wb");
+    uint8_t *row = malloc((size_t) width * 3);
+    int result = fp && row ? 0 : -1;
+    if (result == 0 && fprintf(fp, "P6\n%d %d\n255\n", width, height) < 0) result = -1;
+    for (int i = 0; i < height && result == 0; i++) {
+        colorRow(index + (long) i * width, width, table, row);
+        if (fwrite(row, 3, width, fp) != (size_t) width) result = -1;
+    }
+    if (fp && fclose(fp) != 0) result = -1;
+    free(row);
+    return result;
+}
+
+/*
+ * PNG
+ */
+
+// Color in a row of an index image as RGB, Sub filtered: each byte less
+// the same byte of the pixel on the left, behind the filter type byte.
+static void filterRow(const unsigned short *row, int width, const uint32_t *table, uint8_t *out) {
+    *out++ = 1;
+    uint32_t left = 0;
+    for (int r = 0; r < width; r++, out += 3) {
+        uint32_t color = table[row[r]];
+        out[0] = (color >> 24) - (left >> 24);
+        out[1] = (color >> 16) - (left >> 16);
+        out[2] = (color >> 8) - (left >> 8);
+        left = color;
+    }
+}
+
+/*
+ * Filter and deflate a group of rows into an IDAT
+ * chunk, a few rows at a time. Every group but the
+ * last ends with a sync flush, so the next one can
+ * carry on straight after it in the same stream.
+ */
+static void deflateGroup(struct Deflating *deflating, int g) {
+    struct RowGroup *group = &deflating->groups[g];
+    int width = deflating->width;
+    int first = g * deflating->groupRows;
+    int rows = deflating->height - first < deflating->groupRows ? deflating->height - first : deflating->groupRows;
+    size_t stride = (size_t) width * 3 + 1;
+    group->length = stride * rows;
+    group->adler = adler32(0, NULL, 0);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    uint8_t *filtered = malloc(stride * SLICE_ROWS);
+    if (!filtered || deflateInit2(&stream, PNG_LEVEL, Z_DEFLATED, -15, 8, Z_RLE) != Z_OK) {
+        free(filtered);
+        atomic_store(&deflating->failed, 1);
+        return;
+    }
+    size_t bound = deflateBound(&stream, group->length) + 16;
+    group->data = malloc(8 + bound + 4);
+    if (!group->data) {
+        deflateEnd(&stream);
+        free(filtered);
+        atomic_store(&deflating->failed, 1);
+        return;
+    }
+    stream.next_out = group->data + 8;
+    stream.avail_out = bound;
+
+    int last = g == deflating->groupCount - 1;
+    int status = Z_OK;
+    for (int i = 0; i < rows && status == Z_OK; i += SLICE_ROWS) {
+        int slice = rows - i < SLICE_ROWS ? rows - i : SLICE_ROWS;
+        for (int s = 0; s < slice; s++) {
+            filterRow(deflating->index + (long) (first + i + s) * width, width, deflating->table, filtered + s * stride);
+        }
+        group->adler = adler32(group->adler, filtered, stride * slice);
+        stream.next_in = filtered;
+        stream.avail_in = stride * slice;
+        int flush = i + slice < rows ? Z_NO_FLUSH : last ? Z_FINISH : Z_SYNC_FLUSH;
+        status = deflate(&stream, flush);
+        if (status == Z_STREAM_END && flush == Z_FINISH) break;
+        if (stream.avail_in != 0) status = Z_BUF_ERROR;
+    }
+    if (status != (last ? Z_STREAM_END : Z_OK)) atomic_store(&deflating->failed, 1);
+    size_t length = bound - stream.avail_out;
+    deflateEnd(&stream);
+    free(filtered);
+
+    putBE32(group->data, length);
+    memcpy(group->data + 4, "IDAT", 4);
+    putBE32(group->data + 8 + length, crc32(crc32(0, NULL, 0), group->data + 4, 4 + length));
+    group->size = 8 + length + 4;
+}
+
+/*
+ * Deflate one of the groups of rows of a PNG started
+ * by startPNG. Each group is to be deflated exactly
+ * once, by any thread. Returns 1 if it was the last
+ * of them to be done, and the PNG can be finished.
+ */
+int deflatePNGGroup(struct Deflating *deflating, int g) {
+    int groups = deflating->groupCount; // Read first, as the last thread done frees it
+    deflateGroup(deflating, g);
+    return atomic_fetch_add(&deflating->groupsDone, 1) + 1 == groups;
+}
+
+#if !defined SINGLE_THREADED
+static void* deflateThread(void *arg) {
+    struct Deflating *deflating = arg;
+    int g;
+    while ((g = atomic_fetch_add(&deflating->nextGroup, 1)) < deflating->groupCount) {
+        deflatePNGGroup(deflating, g);
+    }
+    return NULL;
+}
+#endif
+
+static int writeChunk(FILE *fp, const char *type, const uint8_t *data, uint32_t length) {
+    uint8_t header[8];
+    uint8_t crc[4];
+    putBE32(header, length);
+    memcpy(header + 4, type, 4);
+    uLong check = crc32(crc32(0, NULL, 0), header + 4, 4);
+    if (length > 0) check = crc32(check, data, length); // A NULL buffer would reset it
+    putBE32(crc, check);
+    return fwrite(header, 8, 1, fp) == 1 && (length == 0 || fwrite(data, length, 1, fp) == 1) && fwrite(crc, 4, 1, fp) == 1
+        ? 0 : -1;
+}
+
+/*
+ * Start writing an index image colored in through a
+ * color table as an RGB PNG, split into groups of
+ * rows for up to the given number of threads to
+ * deflate side by side. The index image and the table
+ * must stay until the PNG is finished. Returns NULL
+ * if out of memory.
+ */
+struct Deflating* startPNG(const unsigned short *index, int width, int height, const uint32_t *table, int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    struct Deflating *deflating = calloc(1, sizeof(struct Deflating));
+    if (!deflating) return NULL;
+    deflating->index = index;
+    deflating->width = width;
+    deflating->height = height;
+    deflating->table = table;
+    deflating->groupCount = threads * GROUPS_PER_THREAD;
+    if (deflating->groupCount > (height + GROUP_ROWS - 1) / GROUP_ROWS) {
+        deflating->groupCount = (height + GROUP_ROWS - 1) / GROUP_ROWS;
+    }
+    deflating->groupRows = (height + deflating->groupCount - 1) / deflating->groupCount;
+    deflating->groupCount = (height + deflating->groupRows - 1) / deflating->groupRows;
+    deflating->groups = calloc(deflating->groupCount, sizeof(struct RowGroup));
+    if (!deflating->groups) {
+        free(deflating);
+        return NULL;
+    }
+    atomic_init(&deflating->nextGroup, 0);
+    atomic_init(&deflating->groupsDone, 0);
+    atomic_init(&deflating->failed, 0);
+    return deflating;
+}
+
+/*
+ * Write an index image colored in through a color
+ * table as an RGB PNG, with up to the given number of
+ * threads deflating groups of rows side by side (the
+ * caller being one). Returns 0, or -1.
+ */
+int writePNG(const char *path, const unsigned short *index, int width, int height, const uint32_t *table, int threads) {
+    struct Deflating *deflating = startPNG(index, width, height, table, threads);
+    if (!deflating) return -1;
+
+#if !defined SINGLE_THREADED
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    for (; started < deflating->groupCount - 1 && started < threads - 1; started++) {
+        if (pthread_create(&workers[started], NULL, deflateThread, deflating) != 0) break;
+    }
+    deflateThread(deflating); // Lend a hand
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+#else
+    for (int g = 0; g < deflating->groupCount; g++) deflatePNGGroup(deflating, g);
+#endif
+    return finishPNG(deflating, path);
+}
+
+/*
+ * Write out a PNG whose groups have all been
+ * deflated, and free it. Returns 0, or -1.
+ */
+int finishPNG(struct Deflating *deflating, const char *path) {
+    // The stream is the zlib header, the groups one after another, and
+    // the checksum of all the filtered rows
+    uLong adler = adler32(0, NULL, 0);
+    for (int g = 0; g < deflating->groupCount; g++) {
+        adler = adler32_combine(adler, deflating->groups[g].adler, deflating->groups[g].length);
+    }
+    uint8_t header[13];
+    putBE32(header, deflating->width);
+    putBE32(header + 4, deflating->height);
+    header[8] = 8;  // Bits per sample
+    header[9] = 2;  // RGB
+    header[10] = 0; // Deflate
+    header[11] = 0; // Adaptive filtering
+    header[12] = 0; // Not interlaced
+    const uint8_t zlibHeader[2] = { 0x78, 0x01 };
+    uint8_t checksum[4];
+    putBE32(checksum, adler);
+
+    FILE *fp = atomic_load(&deflating->failed) ? NULL : fopen(path, "wb");
+    int result = fp ? 0 : -1;
+    if (result == 0) {
+        if (fwrite("\x89PNG\r\n\x1a\n", 8, 1, fp) != 1) result = -1;
+        if (writeChunk(fp, "IHDR", header, sizeof(header)) != 0) result = -1;
+        if (writeChunk(fp, "IDAT", zlibHeader, sizeof(zlibHeader)) != 0) result = -1;
+        for (int g = 0; g < deflating->groupCount && result == 0; g++) {
+            if (fwrite(deflating->groups[g].data, deflating->groups[g].size, 1, fp) != 1) result = -1;
+        }
+        if (writeChunk(fp, "IDAT", checksum, sizeof(checksum)) != 0) result = -1;
+        if (writeChunk(fp, "IEND", NULL, 0) != 0) result = -1;
+        if (fclose(fp) != 0) result = -1;
+    }
+
+    for (int g = 0; g < deflating->groupCount; g++) free(deflating->groups[g].data);
+    free(deflating->groups);
+    free(deflating);
+    return result;
+}
+
+/*
+ * Background Exports
+ */
+
+// A viewport being rendered again for an export, its tiles split between threads.
+struct Rerender {
+    struct Frame *frame;
+    int tileCount;
+    atomic_int nextTile; // Tile for a thread to take next.
+    atomic_int min;      // Minimum k value over the rendered tiles.
+};
+
+static void rerenderTiles(struct Rerender *rerender) {
+    int min = MAX_K;
+    int t;
+    while ((t = atomic_fetch_add(&rerender->nextTile, 1)) < rerender->tileCount) {
+        renderOrLoadTile(rerender->frame, frameTile(rerender->frame, t), 1, &min, NULL);
+    }
+    int lowest = atomic_load(&rerender->min);
+    while (min < lowest && !atomic_compare_exchange_weak(&rerender->min, &lowest, min));
+}
+
+#if !defined SINGLE_THREADED
+static void* rerenderThread(void *arg) {
+    rerenderTiles(arg);
+    return NULL;
+}
+#endif
+
+/*
+ * Render the viewport of an export at the size asked
+ * for, with the export's threads taking tiles as
+ * they free up, as the viewer's renders do. Returns
+ * NULL if out of memory.
+ */
+static struct Frame* rerenderExport(struct Export *export) {
+    struct Frame *frame = newFrame(NULL, export->x, export->y, export->w, export->columns, export->rows);
+    if (!frame) return NULL;
+    struct Rerender rerender;
+    rerender.frame = frame;
+    rerender.tileCount = frameTiles(frame);
+    atomic_init(&rerender.nextTile, 0);
+    atomic_init(&rerender.min, MAX_K);
+
+#if !defined SINGLE_THREADED
+    int threads = export->threads;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    for (; started < rerender.tileCount - 1 && started < threads - 1; started++) {
+        if (pthread_create(&workers[started], NULL, rerenderThread, &rerender) != 0) break;
+    }
+    rerenderTiles(&rerender); // Lend a hand
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+#else
+    rerenderTiles(&rerender);
+#endif
+
+    frame->min = atomic_load(&rerender.min);
+    frame->scale = 1;
+    return frame;
+}
+
+static void runExport(struct Export *export) {
+    double start = seconds();
+    struct Frame *frame = NULL;
+    export->result = -1;
+    if (!export->index) {
+        // Render the viewport at the size asked for
+        frame = rerenderExport(export);
+        export->index = frame ? malloc((size_t) export->columns * export->rows * sizeof(unsigned short)) : NULL;
+        if (export->index) {
+            indexFrame(frame, export->index);
+            export->min = frame->min;
+        }
+        discardFrame(frame); // Off the main thread, so leaving the frame cache alone
+    }
+    if (export->index) {
+        struct ColorTable table;
+        table.min = -1;
+        buildColorTable(&table, export->useMin ? export->min : 0, MAX_K, export->phase);
+        export->result = writeImage(export->path, export->index, export->columns, export->rows, table.colors, export->threads);
+    }
+    export->seconds = seconds() - start;
+    atomic_store(&export->done, 1);
+}
+
+#if !defined SINGLE_THREADED
+static void* exportThread(void *arg) {
+    runExport(arg);
+    return NULL;
+}
+#endif
+
+/*
+ * Export a frame to a file in the background, at the
+ * given number of columns and rows. Exporting at the
+ * frame's own size (when fully rendered) only needs a
+ * copy of its k values; at any other size the frame's
+ * viewport is rendered again, keeping its origin and
+ * width. Colors are as on screen, relative to the
+ * minimum k value or not, cycled by a phase. Without
+ * worker threads the export is done before returning.
+ * Returns NULL if it could not be started.
+ */
+struct Export* startExport(const char *path, struct Frame *frame, int columns, int rows, short useMin, int phase) {
+    struct Export *export = calloc(1, sizeof(struct Export));
+    if (!export) return NULL;
+    export->path = strdup(path);
+    export->x = frame->x;
+    export->y = frame->y;
+    export->w = frame->w;
+    export->columns = columns;
+    export->rows = rows;
+    export->useMin = useMin;
+    export->phase = phase;
+    int threads = renderThreads < 0 ? defaultRenderThreads() : renderThreads;
+    export->threads = threads > 0 ? threads : 1;
+    atomic_init(&export->done, 0);
+    if (!export->path) {
+        free(export);
+        return NULL;
+    }
+
+    if (columns == frame->columns && rows == frame->rows && frame->scale == 1 && frame->k) {
+        export->index = malloc((size_t) columns * rows * sizeof(unsigned short));
+        if (!export->index) {
+            finishExport(export);
+            return NULL;
+        }
+        indexFrame(frame, export->index);
+        export->min = frame->min;
+    }
+
+#if !defined SINGLE_THREADED
+    if (threads > 0) {
+        export->started = pthread_create(&export->thread, NULL, exportThread, export) == 0;
+        if (!export->started) {
+            finishExport(export);
+            return NULL;
+        }
+        return export;
+    }
+#endif
+    runExport(export);
+    return export;
+}
+
+int exportDone(struct Export *export) {
+    return atomic_load(&export->done);
+}
+
+// Wait for an export to be done.
+void waitForExport(struct Export *export) {
+#if !defined SINGLE_THREADED
+    if (export->started) pthread_join(export->thread, NULL);
+    export->started = 0;
+#endif
+}
+
+/*
+ * Wait for an export to be done and free it. Returns
+ * 0 if the file was written, or -1.
+ */
+int finishExport(struct Export *export) {
+    waitForExport(export);
+    int result = atomic_load(&export->done) ? export->result : -1;
+    free(export->index);
+    free(export->path);
+    free(export);
+    return result;
+}
@@ -0,0 +1,90 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdint.h>
+
+#include "frame.h"
+
+/*
+ * Exporting Frames
+ *
+ * Writes a frame out as an image, colored in the
+ * same way as on screen: a PNG, or a PPM if the file
+ * name ends in .ppm.
+ *
+ * The PNG is compressed a group of rows at a time,
+ * with each group deflated on its own by whichever
+ * thread picks it up, and the groups joined into one
+ * stream (each ends on a byte boundary, so they can
+ * simply follow one another). Rows are filtered by
+ * the difference to the pixel on the left, which
+ * turns the wide bands of a frame into runs of zeros.
+ * writePNG deflates the groups on threads of its own;
+ * a caller with threads of its own to lend can take
+ * the steps itself (startPNG, deflatePNGGroup for
+ * each group, from any thread, then finishPNG).
+ *
+ * An export can also run in the background, so that
+ * the viewer carries on while it is written. It then
+ * works from a copy of the k values, or renders the
+ * viewport again itself when exporting at another
+ * resolution than the frame's, on as many threads as
+ * it compresses with.
+ */
+
+struct RowGroup {
+    uint8_t *data;   // An IDAT chunk of the group's deflated rows.
+    size_t size;     // Bytes of data, the chunk header and CRC included.
+    unsigned long adler;  // Checksum of the group's filtered rows.
+    unsigned long length; // Bytes of filtered rows.
+};
+
+// A PNG being written, its rows deflated a group at a time.
+struct Deflating {
+    const unsigned short *index;
+    int width;
+    int height;
+    const uint32_t *table;
+    int groupRows;
+    int groupCount;
+    struct RowGroup *groups;
+    atomic_int nextGroup;  // Group for writePNG's threads to take next.
+    atomic_int groupsDone;
+    atomic_int failed;
+};
+
+int writeImage(const char*, const unsigned short*, int, int, const uint32_t*, int);
+int writePNG(const char*, const unsigned short*, int, int, const uint32_t*, int);
+int writePPM(const char*, const unsigned short*, int, int, const uint32_t*);
+struct Deflating* startPNG(const unsigned short*, int, int, const uint32_t*, int);
+int deflatePNGGroup(struct Deflating*, int);
+int finishPNG(struct Deflating*, const char*);
+
+struct Export {
+    char *path;
+    double x;  // Viewport to export, as for a Frame.
+    double y;
+    double w;
+    int columns;
+    int rows;
+    unsigned short *index; // Index image of the frame, or NULL to render it first.
+    short min;             // Minimum k value of the frame, when given.
+    short useMin;          // Whether to color relative to the minimum k value.
+    int phase;             // Phase the colors are cycled by.
+    int threads;           // Threads rendering and compressing the image.
+
+    int result;            // 0 once written, -1 if that failed.
+    double seconds;        // Time taken, once done.
+    atomic_int done;
+#if !defined SINGLE_THREADED
+    pthread_t thread;
+    int started;           // Whether thread is running.
+#endif
+};
+
+struct Export* startExport(const char*, struct Frame*, int, int, short, int);
+int exportDone(struct Export*);
+void waitForExport(struct Export*);
+int finishExport(struct Export*);
+
+#endif
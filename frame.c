@@ -0,0 +1,876 @@
+#if defined __linux__
+#define _GNU_SOURCE // For sched_getaffinity
+#include <sched.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "complex.h"
+#include "frame.h"
+#include "kcodec.h"
+#include "palette.h"
+#include "tilecache.h"
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void dropFrame(struct Frame*);
+static void* takeK(long);
+static void returnK(void*, long);
+
+/*
+ * Frame-related Functions
+ */
+
+/*
+ * Size of the k values of a frame with the given
+ * number of columns and rows (bytes). Tiles on the
+ * edges are stored whole.
+ */
+long frameBytes(int columns, int rows) {
+    long tiles = (long) ((columns + TILE_SIZE - 1) / TILE_SIZE) * ((rows + TILE_SIZE - 1) / TILE_SIZE);
+    return tiles * TILE_AREA * sizeof(unsigned short);
+}
+
+/*
+ * Allocate a frame with room for its k values, with
+ * nothing rendered yet. It is not linked into the
+ * history tree until it is visited.
+ */
+struct Frame* newFrame(struct Frame *parent, double originX, double originY, double frameWidth, int columns, int rows) {
+    struct Frame *frame = malloc(sizeof(struct Frame));
+    if (!frame) return NULL;
+    frame->columns = columns;
+    frame->rows = rows;
+    frame->tileColumns = (columns + TILE_SIZE - 1) / TILE_SIZE;
+    frame->k = takeK(frameBytes(columns, rows));
+    if (!frame->k) {
+        free(frame);
+        return NULL;
+    }
+    frame->packed = NULL;
+    frame->parent = parent;
+    frame->child = NULL;
+    frame->sibling = NULL;
+    frame->newer = NULL;
+    frame->older = NULL;
+    frame->x = originX;
+    frame->y = originY;
+    frame->w = frameWidth;
+    frame->min = MAX_K;
+    frame->maxK = MAX_K;
+    frame->scale = 0;
+    frame->iterations = 0;
+    frame->seconds = 0;
+    return frame;
+}
+
+struct Frame* renderFrame(struct Frame *parent, double originX, double originY, double frameWidth, int columns, int rows) {
+    struct Frame *frame = newFrame(parent, originX, originY, frameWidth, columns, rows);
+    if (!frame) return NULL;
+
+    // Render frame
+    double start = seconds();
+    int min = MAX_K; // Initialize to maximum k value
+    long iterations = 0;
+
+    int tiles = frameTiles(frame);
+    for (int t = 0; t < tiles; t++) {
+        iterations += renderOrLoadTile(frame, frameTile(frame, t), 1, &min, NULL);
+    }
+
+    frame->min = min;
+    frame->scale = 1;
+    frame->iterations = iterations;
+    frame->seconds = seconds() - start;
+    return frame;
+}
+
+static void unlinkFrame(struct Frame *frame) {
+    if (!frame->parent) return;
+    struct Frame **link = &frame->parent->child;
+    while (*link && *link != frame) link = &(*link)->sibling;
+    if (*link) *link = frame->sibling;
+    frame->sibling = NULL;
+}
+
+/*
+ * Free a frame along with everything zoomed into
+ * from it, taking them out of the history tree and
+ * the frame cache.
+ */
+void freeFrame(struct Frame *frame) {
+    while (frame->child) freeFrame(frame->child);
+    unlinkFrame(frame);
+    dropFrame(frame);
+    free(frame);
+}
+
+/*
+ * Free a frame that was never visited, so is in
+ * neither the history tree nor the frame cache,
+ * without touching either. Unlike freeFrame, it can
+ * be called from any thread.
+ */
+void discardFrame(struct Frame *frame) {
+    if (!frame) return;
+    returnK(frame->k, frameBytes(frame->columns, frame->rows));
+    freePackedK(frame->packed);
+    free(frame);
+}
+
+/*
+ * Frame Pool
+ */
+
+#define POOL_SIZE 4
+#define CACHE_LINE 64
+
+static void *pool[POOL_SIZE]; // Buffers for k values, ready to be reused, least recently returned first.
+static long poolSizes[POOL_SIZE]; // And their sizes (bytes).
+static int pooled = 0;
+static struct FramePoolStats poolStats;
+#if !defined SINGLE_THREADED
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void lockPool() {
+#if !defined SINGLE_THREADED
+    pthread_mutex_lock(&poolLock);
+#endif
+}
+static void unlockPool() {
+#if !defined SINGLE_THREADED
+    pthread_mutex_unlock(&poolLock);
+#endif
+}
+
+/*
+ * A buffer of the given size for the k values of a
+ * frame, from the pool if it has one (the most
+ * recently returned). Buffers of other sizes are left
+ * in the pool, as frames of several sizes are often
+ * made in turn (an export or a batch alongside the
+ * viewer, the edge tiles of a poster). New buffers
+ * are aligned to cache lines and faulted in up front,
+ * rather than part way through a render. Returns
+ * NULL if out of memory.
+ */
+static void* takeK(long size) {
+    void *k = NULL;
+
+    lockPool();
+    for (int p = pooled - 1; p >= 0; p--) {
+        if (poolSizes[p] != size) continue;
+        k = pool[p];
+        pooled--;
+        memmove(&pool[p], &pool[p + 1], (pooled - p) * sizeof(pool[0]));
+        memmove(&poolSizes[p], &poolSizes[p + 1], (pooled - p) * sizeof(poolSizes[0]));
+        break;
+    }
+    if (!k) {
+        poolStats.created++;
+        if (pooled > 0) poolStats.resized++;
+    }
+    poolStats.taken++;
+    unlockPool();
+    if (k) return k;
+
+    if (posix_memalign(&k, CACHE_LINE, size) != 0) return NULL;
+    memset(k, 0, size);
+    return k;
+}
+
+/*
+ * Hand a buffer for k values back to the pool, making
+ * room if it is full by freeing the buffer that has
+ * been in it longest.
+ */
+static void returnK(void *k, long size) {
+    if (!k) return;
+    void *evicted = NULL;
+    lockPool();
+    poolStats.returned++;
+    if (pooled == POOL_SIZE) {
+        evicted = pool[0];
+        pooled--;
+        memmove(&pool[0], &pool[1], pooled * sizeof(pool[0]));
+        memmove(&poolSizes[0], &poolSizes[1], pooled * sizeof(poolSizes[0]));
+        poolStats.released++;
+    }
+    pool[pooled] = k;
+    poolSizes[pooled++] = size;
+    unlockPool();
+    free(evicted);
+}
+
+struct FramePoolStats framePoolStats() {
+    lockPool();
+    struct FramePoolStats stats = poolStats;
+    stats.pooled = pooled;
+    unlockPool();
+    return stats;
+}
+
+/*
+ * A spare render, kept for the next one instead of
+ * freeing its pixels and allocating them again.
+ */
+static struct Render *spareRender = NULL;
+
+static void freeRender(struct Render *render) {
+    if (!render) return;
+    free(render->pixels);
+    free(render->completed);
+    free(render);
+}
+
+/*
+ * A render with room for the pixels and tiles of the
+ * given frame, or NULL if out of memory.
+ */
+static struct Render* takeRender(struct Frame *frame) {
+    lockPool();
+    struct Render *render = spareRender;
+    spareRender = NULL;
+    unlockPool();
+    if (!render) {
+        render = calloc(1, sizeof(struct Render));
+        if (!render) return NULL;
+    }
+
+    long pixels = (long) frame->columns * frame->rows;
+    int tiles = frameTiles(frame);
+    if (render->pixelCapacity < pixels) {
+        free(render->pixels);
+        render->pixels = malloc(pixels * sizeof(uint32_t));
+        render->pixelCapacity = render->pixels ? pixels : 0;
+    }
+    if (render->tileCapacity < tiles) {
+        free(render->completed);
+        render->completed = malloc(tiles * sizeof(atomic_int));
+        render->tileCapacity = render->completed ? tiles : 0;
+    }
+    if (!render->pixels || !render->completed) {
+        freeRender(render);
+        return NULL;
+    }
+    return render;
+}
+static void returnRender(struct Render *render) {
+    lockPool();
+    if (!spareRender) {
+        spareRender = render;
+        render = NULL;
+    }
+    unlockPool();
+    freeRender(render);
+}
+
+/*
+ * Frame Cache
+ */
+
+long frameCacheBudget = 64L * 1024 * 1024;
+
+static struct Frame *newest = NULL; // Cached frames, most recently visited first.
+static struct Frame *oldest = NULL;
+static long cachedBytes = 0;
+
+// Memory taken by the k values of a frame, packed or not.
+static long cachedSize(struct Frame *frame) {
+    if (frame->k) return frameBytes(frame->columns, frame->rows);
+    if (frame->packed) return packedSize(frame->packed);
+    return 0;
+}
+
+static void uncacheFrame(struct Frame *frame) {
+    if (frame != newest && !frame->newer) return; // Not cached
+    if (frame->newer) frame->newer->older = frame->older; else newest = frame->older;
+    if (frame->older) frame->older->newer = frame->newer; else oldest = frame->newer;
+    frame->newer = NULL;
+    frame->older = NULL;
+    cachedBytes -= cachedSize(frame);
+}
+
+/*
+ * Pack the k values of a cached frame, unless that
+ * runs out of memory.
+ */
+static void packFrame(struct Frame *frame) {
+    struct PackedK *packed = packK(frame);
+    if (!packed) return;
+    cachedBytes -= cachedSize(frame);
+    returnK(frame->k, frameBytes(frame->columns, frame->rows));
+    frame->k = NULL;
+    frame->packed = packed;
+    cachedBytes += cachedSize(frame);
+}
+
+/*
+ * Unpack the k values of a frame that is not in the
+ * cache, using as many threads as a render would.
+ * Returns 0, or -1 if they could not be unpacked.
+ */
+static int unpackFrame(struct Frame *frame) {
+    frame->k = takeK(frameBytes(frame->columns, frame->rows));
+    if (!frame->k) return -1;
+    int threads = renderThreads < 0 ? defaultRenderThreads() : renderThreads;
+    if (unpackK(frame->packed, frame, threads) != 0) return -1;
+    freePackedK(frame->packed);
+    frame->packed = NULL;
+    return 0;
+}
+
+/*
+ * Take the k values of a frame out of the cache and
+ * free them. The frame stays in the history tree.
+ */
+static void dropFrame(struct Frame *frame) {
+    uncacheFrame(frame);
+    returnK(frame->k, frameBytes(frame->columns, frame->rows));
+    frame->k = NULL;
+    freePackedK(frame->packed);
+    frame->packed = NULL;
+    frame->min = MAX_K;
+    frame->scale = 0;
+    frame->iterations = 0;
+    frame->seconds = 0;
+}
+
+/*
+ * Mark a frame as the most recently visited, both in
+ * the frame cache and among the children of its
+ * parent, then bring the cache back within budget.
+ * A cached frame has its k values unpacked, and the
+ * frame visited before it is packed.
+ */
+void visitFrame(struct Frame *frame) {
+    if (frame->parent) {
+        unlinkFrame(frame);
+        frame->sibling = frame->parent->child;
+        frame->parent->child = frame;
+    }
+    if (!frame->k && !frame->packed) return;
+
+    uncacheFrame(frame);
+    if (!frame->k && unpackFrame(frame) != 0) {
+        dropFrame(frame);
+        return;
+    }
+    if (newest && newest->k) packFrame(newest);
+
+    frame->older = newest;
+    if (newest) newest->newer = frame; else oldest = frame;
+    newest = frame;
+    cachedBytes += cachedSize(frame);
+
+    while (cachedBytes > frameCacheBudget && oldest != frame) {
+        dropFrame(oldest);
+    }
+}
+
+/*
+ * Find a cached frame with the given viewport, size
+ * and iteration cap, to within a fraction of a point
+ * of the viewport, or NULL.
+ */
+struct Frame* findFrame(double originX, double originY, double frameWidth, int columns, int rows, int maxK) {
+    double tolerance = 0.1 * frameGap(frameWidth, columns);
+    for (struct Frame *frame = newest; frame; frame = frame->older) {
+        if (frame->columns != columns || frame->rows != rows || frame->maxK != maxK) continue;
+        if (fabs(frame->w - frameWidth) > 1e-6 * frameWidth) continue;
+        if (fabs(frame->x - originX) > tolerance || fabs(frame->y - originY) > tolerance) continue;
+        return frame;
+    }
+    return NULL;
+}
+
+/*
+ * Number of points computed for a frame at the
+ * given scale.
+ */
+long frameSamples(int columns, int rows, int scale) {
+    long sampledColumns = (columns + scale - 1) / scale;
+    long sampledRows = (rows + scale - 1) / scale;
+    return sampledColumns * sampledRows;
+}
+
+/*
+ * Distance between neighbouring points of a frame
+ * with the given width and number of columns.
+ */
+double frameGap(double frameWidth, int columns) {
+    return frameWidth / (columns + 1);
+}
+
+/*
+ * Coordinates on the complex plane of the point
+ * sampled at a given column or row of a frame with
+ * the given origin and gap. Fractional columns and
+ * rows are allowed, which is useful for mapping
+ * between frames.
+ */
+double frameReal(double originX, double gap, double column) {
+    return originX + (column + 5)*gap;
+}
+double frameImag(double originY, double gap, int rows, double row) {
+    return originY + (rows - 2 - row)*gap;
+}
+
+/*
+ * The k value of the point at the given coordinates:
+ * the iteration at which it escaped, or maxK + 1 if
+ * it never did.
+ */
+short pointK(double real, double imag, short maxK) {
+    struct Complex z = { 0.0, 0.0 };
+    struct Complex c = { real, imag };
+    double magnitude;
+
+    short k;
+    for (k = 0; k <= maxK; k++) {
+        /*
+         * Mandelbrot Equation: Zn+1 = Zn^2 + C
+         */
+        z = cadd(cmul(z,z), c);
+
+        /**
+         * Absolute Value of Z, |Z|.
+         * Absolute Value of N can be formulated as sqrt(N^2)
+         * For Complex Numbers, this essentially becomes the Distance Formula.
+         * Distance Formula: SZ^2 = R^2 + I^2
+         */
+        magnitude = sqrt((z.r * z.r) + (z.i * z.i));
+        if (magnitude > 2) break;
+    }
+    return k;
+}
+
+/*
+ * Tiles
+ */
+
+int frameTiles(struct Frame *frame) {
+    return frame->tileColumns * ((frame->rows + TILE_SIZE - 1) / TILE_SIZE);
+}
+
+struct Tile frameTile(struct Frame *frame, int t) {
+    struct Tile tile;
+    tile.x = (t % frame->tileColumns) * TILE_SIZE;
+    tile.y = (t / frame->tileColumns) * TILE_SIZE;
+    tile.w = tile.x + TILE_SIZE > frame->columns ? frame->columns - tile.x : TILE_SIZE;
+    tile.h = tile.y + TILE_SIZE > frame->rows ? frame->rows - tile.y : TILE_SIZE;
+    return tile;
+}
+
+/*
+ * Copy the k values of the sampled part of a frame
+ * into a row-major image with the given stride
+ * (values per row), a run of up to a tile's width
+ * at a time.
+ */
+void copyFrameRows(struct Frame *frame, unsigned short *out, int stride) {
+    int tiles = frameTiles(frame);
+    for (int t = 0; t < tiles; t++) {
+        struct Tile tile = frameTile(frame, t);
+        const unsigned short *k = FRAME_TILE(frame, t);
+        for (int i = 0; i < tile.h; i++) {
+            memcpy(out + (long) (tile.y + i)*stride + tile.x, k + i*TILE_SIZE, tile.w * sizeof(unsigned short));
+        }
+    }
+}
+
+/*
+ * Render the k values of a single tile of the frame,
+ * computing every scale-th point and copying it over
+ * the block it starts. Points the frame already has
+ * at a coarser scale are kept. The minimum k value
+ * is folded into min. Returns the number of
+ * iterations done, or -1 if the cancelled flag was
+ * raised part way through.
+ */
+long renderTile(struct Frame *frame, struct Tile tile, int scale, int *min, atomic_int *cancelled) {
+    int known = frame->scale > scale ? frame->scale : 0;
+    short maxK = frame->maxK;
+    double gap = frameGap(frame->w, frame->columns);
+    long iterations = 0;
+
+    for (int x = tile.x; x < tile.x + tile.w; x += scale) { // X-axis is the real axis
+        if (cancelled && atomic_load(cancelled)) return -1;
+        double r = frameReal(frame->x, gap, x);
+
+        for (int y = tile.y; y < tile.y + tile.h; y += scale) {
+            if (known && x % known == 0 && y % known == 0) continue;
+
+            double i = frameImag(frame->y, gap, frame->rows, y);
+            short k = pointK(r, i, maxK);
+            iterations += k;
+
+            // Todo: use a function pointer to create a callback which allows
+            //       the implementation of a progress bar?
+
+            for (int by = y; by < y + scale && by < tile.y + tile.h; by++) {
+                for (int bx = x; bx < x + scale && bx < tile.x + tile.w; bx++) {
+                    FRAME_K(frame, bx, by) = k;
+                }
+            }
+            if (k < *min) *min = k;
+        }
+    }
+
+    return iterations;
+}
+
+struct TileCache *tileCache = NULL;
+struct Checkpoint *renderCheckpoint = NULL;
+
+/*
+ * Load a tile from the checkpoint or the tile cache
+ * if it is there, or else render it (at the given
+ * scale, like renderTile) and store it if it was
+ * rendered in full. Returns the number of iterations
+ * done, or -1 if cancelled.
+ */
+long renderOrLoadTile(struct Frame *frame, struct Tile tile, int scale, int *min, atomic_int *cancelled) {
+    if (renderCheckpoint && loadCheckpointTile(renderCheckpoint, frame, tile, min) == 0) return 0;
+    if (tileCache && loadCachedTile(tileCache, frame, tile, min) == 0) {
+        if (renderCheckpoint) saveCheckpointTile(renderCheckpoint, frame, tile);
+        return 0;
+    }
+    long iterations = renderTile(frame, tile, scale, min, cancelled);
+    if (scale == 1 && iterations >= 0) {
+        if (tileCache) storeCachedTile(tileCache, frame, tile);
+        if (renderCheckpoint) saveCheckpointTile(renderCheckpoint, frame, tile);
+    }
+    return iterations;
+}
+
+/*
+ * Background Rendering
+ */
+
+int renderThreads = -1;
+
+/*
+ * Fold a rendered tile into the render: color it in
+ * relative to the lowest k value found so far and
+ * publish it to the caller.
+ */
+static void publishTile(struct Render *render, int t, long iterations, int *min, struct ColorTable *table) {
+    struct Tile tile = frameTile(render->frame, t);
+    atomic_fetch_add(&render->iterations, iterations);
+
+    // Lower the shared minimum, then color the tile relative to it
+    int shared = atomic_load(&render->min);
+    while (*min < shared && !atomic_compare_exchange_weak(&render->min, &shared, *min));
+    if (shared < *min) *min = shared;
+    buildColorTable(table, atomic_load(&render->useMin) ? *min : 0, render->frame->maxK, 0);
+    colorTile(render->frame, tile, table->colors, render->pixels, render->frame->columns);
+
+    // Publish the tile
+    int position = atomic_fetch_add(&render->published, 1);
+    if (position == render->tileCount - 1) render->seconds = seconds() - render->start;
+    atomic_store(&render->completed[position], t);
+    atomic_fetch_add(&render->tilesDone, 1);
+}
+
+#if !defined SINGLE_THREADED
+static void* renderThread(void *arg) {
+    struct Render *render = arg;
+    int min = atomic_load(&render->min);
+    struct ColorTable table = { -1 };
+
+    int t;
+    while ((t = atomic_fetch_add(&render->nextTile, 1)) < render->tileCount) {
+        long iterations = renderOrLoadTile(render->frame, frameTile(render->frame, t), render->scale, &min, &render->cancelled);
+        if (iterations < 0) break;
+        publishTile(render, t, iterations, &min, &table);
+    }
+
+    return NULL;
+}
+#endif
+
+/*
+ * One worker per CPU this process may run on. With
+ * a single CPU a worker thread would only compete
+ * with the caller, so renders are cooperative.
+ */
+int defaultRenderThreads() {
+#if defined SINGLE_THREADED
+    return 0;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#if defined __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) cpus = CPU_COUNT(&allowed);
+#endif
+    if (cpus <= 1) return 0;
+    return cpus > MAX_THREADS ? MAX_THREADS : cpus;
+#endif
+}
+
+static struct Render* launchRender(struct Frame *frame, int scale, int refining, int useMin) {
+    struct Render *render = takeRender(frame);
+    if (!render) return NULL;
+
+    render->frame = frame;
+    render->tileCount = frameTiles(frame);
+    render->scale = scale;
+    render->refining = refining;
+    render->reviving = 0;
+    render->start = seconds();
+    render->seconds = 0;
+    atomic_init(&render->cancelled, 0);
+    atomic_init(&render->useMin, useMin);
+    atomic_init(&render->nextTile, 0);
+    atomic_init(&render->min, refining ? (int) frame->min : MAX_K);
+    atomic_init(&render->published, 0);
+    atomic_init(&render->tilesDone, 0);
+    atomic_init(&render->iterations, 0);
+    for (int t = 0; t < render->tileCount; t++) atomic_init(&render->completed[t], -1);
+
+    render->tile = 0;
+    render->column = 0;
+    render->table = NULL;
+    render->tileIterations = 0;
+    render->pendingCount = 0;
+    render->slices = 0;
+    render->busySeconds = 0;
+    render->computeSeconds = 0;
+    render->cacheSeconds = 0;
+
+    render->threadCount = 0;
+#if !defined SINGLE_THREADED
+    int workers = renderThreads < 0 ? defaultRenderThreads() : renderThreads;
+    if (workers > MAX_THREADS) workers = MAX_THREADS;
+    for (; render->threadCount < workers; render->threadCount++) {
+        if (pthread_create(&render->threads[render->threadCount], NULL, renderThread, render) != 0) break;
+    }
+    if (workers > 0 && render->threadCount == 0) {
+        returnRender(render);
+        return NULL;
+    }
+#endif
+    return render;
+}
+
+static void joinRender(struct Render *render) {
+#if !defined SINGLE_THREADED
+    for (int i = 0; i < render->threadCount; i++) pthread_join(render->threads[i], NULL);
+#endif
+}
+
+struct Render* startRender(struct Frame *parent, double originX, double originY, double frameWidth, int columns, int rows, int scale, int useMin) {
+    struct Frame *frame = newFrame(parent, originX, originY, frameWidth, columns, rows);
+    if (!frame) return NULL;
+
+    struct Render *render = launchRender(frame, scale, 0, useMin);
+    if (!render) freeFrame(frame);
+    return render;
+}
+
+/*
+ * Render a frame that was rendered at a coarser
+ * scale again at full resolution, in place. Points
+ * already computed are not computed again.
+ */
+struct Render* refineFrame(struct Frame *frame, int useMin) {
+    return launchRender(frame, 1, 1, useMin);
+}
+
+/*
+ * Render a frame of the history tree whose k values
+ * were dropped from the frame cache again, in place.
+ */
+struct Render* reviveFrame(struct Frame *frame, int scale, int useMin) {
+    frame->k = takeK(frameBytes(frame->columns, frame->rows));
+    if (!frame->k) return NULL;
+
+    struct Render *render = launchRender(frame, scale, 0, useMin);
+    if (!render) {
+        dropFrame(frame);
+        return NULL;
+    }
+    render->reviving = 1;
+    return render;
+}
+
+int renderDone(struct Render *render) {
+    return atomic_load(&render->tilesDone) == render->tileCount;
+}
+
+// Store a finished tile of a render in the tile cache and the checkpoint.
+static void storeTile(struct Render *render, int t) {
+    struct Tile tile = frameTile(render->frame, t);
+    if (tileCache) storeCachedTile(tileCache, render->frame, tile);
+    if (renderCheckpoint) saveCheckpointTile(renderCheckpoint, render->frame, tile);
+}
+
+/*
+ * Advance a cooperative render for about the given
+ * number of seconds. Tiles are rendered a block of
+ * columns at a time, so a slice can end part way
+ * through a tile; the next call picks up from there.
+ *
+ * Storing a tile on disk means syncing a file, so
+ * finished tiles are held back and stored at the
+ * start of later slices, as many as fit in them,
+ * rather than straight away in the slice that
+ * finished them. Tiles still held back when a
+ * render is cancelled are not stored.
+ */
+void stepRender(struct Render *render, double slice) {
+    double start = seconds();
+    double now = start;
+    int min = atomic_load(&render->min);
+
+    if (!render->table) {
+        render->table = malloc(sizeof(struct ColorTable));
+        if (!render->table) return;
+        render->table->min = -1;
+    }
+
+    while (render->pendingCount > 0 && now - start < slice) {
+        storeTile(render, render->pendingStores[0]);
+        render->pendingCount--;
+        memmove(render->pendingStores, render->pendingStores + 1, render->pendingCount * sizeof(int));
+        now = seconds();
+    }
+    render->cacheSeconds += now - start;
+
+    while (render->tile < render->tileCount && now - start < slice) {
+        struct Tile tile = frameTile(render->frame, render->tile);
+        if (render->column <= tile.x) {
+            render->column = tile.x;
+
+            // Starting on the tile, which may be on disk already
+            double looking = now;
+            int loaded =
+                (renderCheckpoint && loadCheckpointTile(renderCheckpoint, render->frame, tile, &min) == 0) ||
+                (tileCache && loadCachedTile(tileCache, render->frame, tile, &min) == 0);
+            if (loaded && renderCheckpoint) saveCheckpointTile(renderCheckpoint, render->frame, tile);
+            now = seconds();
+            render->cacheSeconds += now - looking;
+            if (loaded) {
+                publishTile(render, render->tile, 0, &min, render->table);
+                render->tile++;
+                render->column = 0;
+                now = seconds();
+                continue;
+            }
+        }
+
+        struct Tile columns = tile;
+        columns.x = render->column;
+        columns.w = tile.x + tile.w - columns.x;
+        if (columns.w > render->scale) columns.w = render->scale;
+
+        double before = seconds();
+        render->tileIterations += renderTile(render->frame, columns, render->scale, &min, NULL);
+        render->column += render->scale;
+        if (render->column >= tile.x + tile.w) {
+            publishTile(render, render->tile, render->tileIterations, &min, render->table);
+            if ((tileCache || renderCheckpoint) && render->scale == 1) {
+                if (render->pendingCount == PENDING_STORES) {
+                    // Falling behind, so store the oldest now
+                    double storing = seconds();
+                    storeTile(render, render->pendingStores[0]);
+                    render->pendingCount--;
+                    memmove(render->pendingStores, render->pendingStores + 1, render->pendingCount * sizeof(int));
+                    double stored = seconds();
+                    render->cacheSeconds += stored - storing;
+                    before += stored - storing; // Not counted as rendering
+                }
+                render->pendingStores[render->pendingCount++] = render->tile;
+            }
+            render->tile++;
+            render->column = 0;
+            render->tileIterations = 0;
+        }
+        now = seconds();
+        render->computeSeconds += now - before;
+    }
+
+    render->slices++;
+    render->busySeconds += seconds() - start;
+}
+
+/*
+ * Stop a render. A new frame is thrown away, a frame
+ * being revived goes back to having no k values, and
+ * a frame being refined keeps its coarser scale (some
+ * of its tiles may be refined already).
+ */
+void cancelRender(struct Render *render) {
+    atomic_store(&render->cancelled, 1);
+    joinRender(render);
+    if (render->reviving) {
+        dropFrame(render->frame);
+    } else if (!render->refining) {
+        freeFrame(render->frame);
+    }
+    free(render->table);
+    returnRender(render);
+}
+
+/*
+ * Wait for a render to complete and hand over its
+ * frame, as the most recently visited. A new frame
+ * becomes the latest child of its parent.
+ */
+struct Frame* finishRender(struct Render *render) {
+    joinRender(render);
+    if (render->threadCount == 0) stepRender(render, INFINITY);
+    struct Frame *frame = render->frame;
+    frame->min = atomic_load(&render->min);
+    frame->scale = render->scale;
+    frame->iterations += render->iterations;
+    frame->seconds += render->seconds;
+
+    visitFrame(frame);
+    free(render->table);
+    returnRender(render);
+    return frame;
+}
+
+/*
+ * Frame-time Budget
+ */
+
+/*
+ * Pick the finest scale at which a viewport of the
+ * given size is expected to render within the budget,
+ * assuming it costs about as much per point as the
+ * given frame.
+ */
+int chooseScale(struct Budget *budget, struct Frame *like, int columns, int rows) {
+    if (budget->rate == 0 || like->iterations == 0) return 1;
+    double perSample = (double) like->iterations / frameSamples(like->columns, like->rows, like->scale);
+
+    int scale;
+    for (scale = 1; scale < MAX_SCALE; scale *= 2) {
+        double predicted = budget->rate * perSample * frameSamples(columns, rows, scale);
+        if (predicted <= budget->target) break;
+    }
+    return scale;
+}
+
+/*
+ * Fold the iterations and time taken by a render
+ * into the recent rate.
+ */
+void recordRender(struct Budget *budget, long iterations, double time) {
+    if (iterations <= 0) return;
+    double rate = time / iterations;
+    budget->rate = budget->rate == 0 ? rate : (budget->rate + rate) / 2;
+}
@@ -0,0 +1,278 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#if !defined SINGLE_THREADED
+#include <pthread.h>
+#endif
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The Frame struct stores a single frame of the
+ * Mandelbrot set. A frame is defined as the k
+ * values at all points in a grid (580 x 406 by
+ * default) given an origin point and width.
+ * Depending on the width, frames may be at
+ * different levels of magnification.
+ *
+ * Frames form a history tree: each frame has a
+ * pointer to its parent, which it was zoomed into
+ * from, and to its children, the frames zoomed
+ * into from it, most recently visited first.
+ */
+
+// Default Width and Height of the grid of a frame.
+#define FRAME_WIDTH 580
+#define FRAME_HEIGHT 406
+
+// Maximum number of iterations per point. Can be set when building
+// (-DMAX_K=5000, up to 30000), for every file alike. A frame can be
+// rendered with a lower cap of its own (see Frame.maxK).
+#if !defined MAX_K
+#define MAX_K 1000
+#endif
+
+// Coarsest resolution a frame is rendered at, as a divisor of its size.
+#define MAX_SCALE 4
+
+struct Frame {
+    struct Frame *parent;
+    struct Frame *child;   // Most recently visited child.
+    struct Frame *sibling; // Next most recently visited child of the parent.
+
+    // Points sampled along each axis. The grid is one point wider and
+    // taller; its last column and row lie underneath the frame border.
+    int columns;
+    int rows;
+
+    // Values of k at each point, tile by tile (see FRAME_K). NULL
+    // while not in the frame cache or while packed.
+    unsigned short *k;
+    int tileColumns; // Tiles across the frame.
+    struct PackedK *packed; // Values of k, compressed, or NULL.
+    double min; // Minimum k value in this frame.
+    short maxK; // Iteration cap, MAX_K unless lowered before rendering.
+
+    // The origin is the bottom-left corner.
+    double x; // Origin on the x axis.
+    double y; // Origin on the y axis.
+
+    double w; // Width.
+
+    // Only every scale-th point along each axis has been computed,
+    // and its k value copied over the scale x scale block it starts.
+    // 1 is full resolution, 0 means nothing has been rendered yet.
+    int scale;
+
+    long iterations; // Iterations spent rendering the frame so far.
+    double seconds;  // Time spent rendering the frame so far.
+
+    // Place in the frame cache, when the frame has k values.
+    struct Frame *newer;
+    struct Frame *older;
+};
+
+struct Frame* newFrame(struct Frame*, double, double, double, int, int);
+struct Frame* renderFrame(struct Frame*, double, double, double, int, int);
+void freeFrame(struct Frame*);
+void discardFrame(struct Frame*);
+long frameBytes(int, int);
+long frameSamples(int, int, int);
+
+/*
+ * Frame Pool
+ *
+ * Buffers for k values are recycled through a small
+ * pool instead of going back to the allocator, which
+ * would hand out fresh pages to fault in each time.
+ * When it is full, the buffer pooled longest is freed
+ * to make room, so buffers of a few sizes can be
+ * pooled side by side.
+ */
+
+struct FramePoolStats {
+    long taken;    // Buffers handed out.
+    long created;  // Of which were newly allocated.
+    long resized;  // Of those, while the pool only had buffers of other sizes.
+    long returned; // Buffers handed back.
+    long released; // Buffers freed to make room in the pool.
+    int pooled;    // Buffers in the pool now.
+};
+
+struct FramePoolStats framePoolStats();
+
+/*
+ * Frame Cache
+ *
+ * The history tree is kept for good, but the k
+ * values of its frames are held in a cache with a
+ * memory budget. Only the most recently visited
+ * frame keeps them as they are; the others are
+ * packed, and unpacked when visited again. When the
+ * cache is over budget the least recently visited
+ * frames lose their k values, and are rendered
+ * again if they are visited again.
+ * Frames can be found in the cache by viewport and
+ * iteration cap, so that returning to one does not
+ * render it again. The formula is fixed at compile
+ * time, but frames may have lower caps than MAX_K,
+ * so the key is the viewport and the cap.
+ */
+
+// Memory the cache may hold (bytes).
+extern long frameCacheBudget;
+
+void visitFrame(struct Frame*);
+struct Frame* findFrame(double, double, double, int, int, int);
+
+double frameGap(double, int);
+double frameReal(double, double, double);
+double frameImag(double, double, int, double);
+short pointK(double, double, short);
+
+/*
+ * Tiles
+ *
+ * The sampled part of a frame is split into square
+ * tiles so that it can be rendered (and displayed)
+ * piece by piece. Tiles are numbered row by row
+ * starting at the top-left corner; the tiles on the
+ * right and bottom edges may be smaller.
+ *
+ * The k values are stored the same way: tile after
+ * tile, each a full TILE_SIZE x TILE_SIZE block, row
+ * by row. A tile is then one contiguous 8 KB block
+ * whichever way it is walked, and its rows can be
+ * copied straight into row-major images.
+ */
+
+#define TILE_SIZE 64
+#define TILE_AREA (TILE_SIZE * TILE_SIZE)
+
+// The k values of tile t of a frame, row by row, TILE_SIZE apart.
+#define FRAME_TILE(frame, t) ((frame)->k + (size_t) (t) * TILE_AREA)
+
+// Offset in k of the value at a column and row of a frame.
+#define FRAME_OFFSET(frame, column, row) \
+    ((size_t) ((row) / TILE_SIZE * (frame)->tileColumns + (column) / TILE_SIZE) * TILE_AREA \
+        + (row) % TILE_SIZE * TILE_SIZE + (column) % TILE_SIZE)
+
+// The k value at a column and row of a frame.
+#define FRAME_K(frame, column, row) ((frame)->k[FRAME_OFFSET(frame, column, row)])
+
+struct Tile {
+    int x; // Left-most column.
+    int y; // Top-most row.
+    int w;
+    int h;
+};
+
+int frameTiles(struct Frame*);
+struct Tile frameTile(struct Frame*, int);
+void copyFrameRows(struct Frame*, unsigned short*, int);
+long renderTile(struct Frame*, struct Tile, int, int*, atomic_int*);
+long renderOrLoadTile(struct Frame*, struct Tile, int, int*, atomic_int*);
+
+// Tiles on disk, consulted before rendering a tile, or NULL (see tilecache.h).
+extern struct TileCache *tileCache;
+
+// Tiles of a long render kept on disk as they complete, so that it can
+// be resumed, or NULL (see checkpoint.h). Consulted before the tile cache.
+extern struct Checkpoint *renderCheckpoint;
+
+/*
+ * Background Rendering
+ *
+ * A Render computes a frame on a pool of worker
+ * threads, one tile at a time, so that the caller
+ * can keep handling input. Each worker also colors
+ * in the tiles it renders, and then publishes them
+ * so the caller can show them as they complete.
+ *
+ * With no worker threads (on a single core, or when
+ * built with SINGLE_THREADED) a render is instead
+ * cooperative: the caller advances it a time slice
+ * at a time with stepRender, between handling input.
+ */
+
+#define MAX_THREADS 64
+
+// Finished tiles a cooperative render holds back from the caches, at most.
+#define PENDING_STORES 16
+
+// Worker threads per render, 0 for cooperative renders. Defaults to
+// -1, for one per available CPU (or cooperative if there is only one).
+extern int renderThreads;
+
+struct Render {
+    struct Frame *frame;
+#if !defined SINGLE_THREADED
+    pthread_t threads[MAX_THREADS];
+#endif
+    int threadCount;
+    int scale;    // Resolution being rendered at.
+    int refining; // Whether frame already existed at a coarser scale.
+    int reviving; // Whether frame is in the history tree, but was not cached.
+    double start; // When the render started.
+
+    atomic_int cancelled;
+    atomic_int useMin;   // Whether to color tiles relative to the minimum k value.
+    atomic_int nextTile; // Next tile to be picked up by a worker.
+    atomic_int min;      // Minimum k value over the completed tiles.
+
+    // Completed tiles in the order they were published. Entries are
+    // -1 until the tile in that position has been published.
+    int tileCount;
+    atomic_int *completed;
+    atomic_int published; // Positions in completed handed out so far.
+    atomic_int tilesDone; // Tiles fully published.
+
+    // Colored tiles as RGBA8888 pixels, one row of the frame per row.
+    uint32_t *pixels;
+    long pixelCapacity; // Pixels allocated, which may be more than used.
+    int tileCapacity;   // Entries of completed allocated.
+
+    atomic_long iterations; // Iterations spent by this render.
+    double seconds;         // Time taken by this render, once done.
+
+    // Progress of a cooperative render
+    int tile;              // Tile being rendered.
+    int column;            // Column of that tile to resume at.
+    long tileIterations;   // Iterations spent on that tile so far.
+    struct ColorTable *table; // Colors for the tiles, allocated on first use.
+    int pendingStores[PENDING_STORES]; // Finished tiles yet to be stored, oldest first.
+    int pendingCount;
+    int slices;            // Calls to stepRender so far.
+    double busySeconds;    // Time spent in stepRender.
+    double computeSeconds; // Of which spent rendering and coloring tiles.
+    double cacheSeconds;   // And loading and storing tiles on disk.
+};
+
+struct Render* startRender(struct Frame*, double, double, double, int, int, int, int);
+struct Render* refineFrame(struct Frame*, int);
+struct Render* reviveFrame(struct Frame*, int, int);
+int renderDone(struct Render*);
+void stepRender(struct Render*, double);
+int defaultRenderThreads();
+void cancelRender(struct Render*);
+struct Frame* finishRender(struct Render*);
+
+/*
+ * Frame-time Budget
+ *
+ * Keeps track of how long recent renders took per
+ * iteration, and uses that to pick a resolution at
+ * which a new viewport can be rendered within the
+ * target time. The frame can be refined later.
+ */
+
+struct Budget {
+    double target; // Seconds allowed for the first image of a viewport.
+    double rate;   // Recent seconds per iteration, 0 until measured.
+};
+
+int chooseScale(struct Budget*, struct Frame*, int, int);
+void recordRender(struct Budget*, long, double);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * To build and run: `gcc -O2 kbench.c frame.c palette.c kcodec.c tilecache.c checkpoint.c complex.c -lm -lpthread -lz -o kbench && ./kbench`
+ * (must be done in the root project folder)
+ *
+ * Add -DHAVE_ZSTD and -lzstd to compare against zstd as well.
+ *
+ * Renders a few views and compares the k value codec with general
+ * purpose compressors on the same k values (16 bit, row by row), for
+ * size and speed, checking that everything decodes back exactly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <zlib.h>
+#if defined HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "frame.h"
+#include "kcodec.h"
+
+#define COLUMNS 579
+#define ROWS 405
+
+// Times each codec is run per view, taking the fastest.
+#define RUNS 10
+
+// Views to compare on: from the whole set down to deep in a spiral.
+const double VIEWS[][3] = {
+    { -2.5, -1.25, 3.5 },
+    { -0.8, -0.2, 0.4 },
+    { -0.75, 0.05, 0.02 },
+    { -0.7453, 0.1127, 0.00065 },
+    { 0.25, -0.05, 0.1 }
+};
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void report(const char *codec, size_t raw, size_t size, double encode, double decode, int exact) {
+    printf(
+        "  %-16s %8zu bytes %6.1fx  encode %7.1f MB/s  decode %7.1f MB/s%s\n",
+        codec, size, (double) raw / size, raw / encode / 1e6, raw / decode / 1e6, exact ? "" : "  MISMATCH"
+    );
+}
+
+static void benchKCodec(struct Frame *frame, const unsigned short *rows, int threads) {
+    size_t raw = (size_t) COLUMNS * ROWS * sizeof(unsigned short);
+    double encode = 1e9;
+    double decode = 1e9;
+    size_t size = 0;
+    uint8_t *encoded = NULL;
+    for (int r = 0; r < RUNS; r++) {
+        free(encoded);
+        double start = now();
+        encoded = encodeK(frame, threads, &size);
+        double time = now() - start;
+        if (time < encode) encode = time;
+    }
+
+    // Decode into a blank copy of the k values
+    unsigned short *k = frame->k;
+    frame->k = calloc(1, frameBytes(COLUMNS, ROWS));
+    int result = 0;
+    for (int r = 0; r < RUNS; r++) {
+        double start = now();
+        result |= decodeK(encoded, size, frame, threads);
+        double time = now() - start;
+        if (time < decode) decode = time;
+    }
+
+    unsigned short *decoded = malloc(raw);
+    copyFrameRows(frame, decoded, COLUMNS);
+
+    // A decoded frame keeps its viewport, cap and minimum
+    struct Frame *copy = decodeFrame(encoded, size, threads);
+    int same = copy && copy->x == frame->x && copy->y == frame->y && copy->w == frame->w
+        && copy->maxK == frame->maxK && copy->min == frame->min;
+    if (copy) discardFrame(copy);
+
+    char name[32];
+    snprintf(name, sizeof(name), "kcodec (%d %s)", threads, threads == 1 ? "thread" : "threads");
+    report(name, raw, size, encode, decode, result == 0 && same && memcmp(decoded, rows, raw) == 0);
+
+    free(decoded);
+    free(frame->k);
+    frame->k = k;
+    free(encoded);
+}
+
+static void benchZlib(const unsigned short *rows, int level) {
+    uLong raw = (uLong) COLUMNS * ROWS * sizeof(unsigned short);
+    uLongf bound = compressBound(raw);
+    Bytef *compressed = malloc(bound);
+    unsigned short *decompressed = malloc(raw);
+    double encode = 1e9;
+    double decode = 1e9;
+    uLongf size = 0;
+    for (int r = 0; r < RUNS; r++) {
+        size = bound;
+        double start = now();
+        compress2(compressed, &size, (const Bytef*) rows, raw, level);
+        double time = now() - start;
+        if (time < encode) encode = time;
+    }
+    int exact = 1;
+    for (int r = 0; r < RUNS; r++) {
+        uLongf length = raw;
+        double start = now();
+        exact &= uncompress((Bytef*) decompressed, &length, compressed, size) == Z_OK && length == raw;
+        double time = now() - start;
+        if (time < decode) decode = time;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "zlib -%d", level);
+    report(name, raw, size, encode, decode, exact && memcmp(decompressed, rows, raw) == 0);
+    free(compressed);
+    free(decompressed);
+}
+
+#if defined HAVE_ZSTD
+static void benchZstd(const unsigned short *rows, int level) {
+    size_t raw = (size_t) COLUMNS * ROWS * sizeof(unsigned short);
+    size_t bound = ZSTD_compressBound(raw);
+    void *compressed = malloc(bound);
+    unsigned short *decompressed = malloc(raw);
+    double encode = 1e9;
+    double decode = 1e9;
+    size_t size = 0;
+    for (int r = 0; r < RUNS; r++) {
+        double start = now();
+        size = ZSTD_compress(compressed, bound, rows, raw, level);
+        double time = now() - start;
+        if (time < encode) encode = time;
+    }
+    int exact = !ZSTD_isError(size);
+    for (int r = 0; r < RUNS && exact; r++) {
+        double start = now();
+        exact &= ZSTD_decompress(decompressed, raw, compressed, size) == raw;
+        double time = now() - start;
+        if (time < decode) decode = time;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "zstd -%d", level);
+    report(name, raw, size, encode, decode, exact && memcmp(decompressed, rows, raw) == 0);
+    free(compressed);
+    free(decompressed);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    int threads = defaultRenderThreads();
+    if (argc > 1) threads = atoi(argv[1]);
+    if (threads < 1) threads = 1;
+
+    unsigned short *rows = malloc((size_t) COLUMNS * ROWS * sizeof(unsigned short));
+    for (size_t v = 0; v < sizeof(VIEWS) / sizeof(VIEWS[0]); v++) {
+        struct Frame *frame = renderFrame(NULL, VIEWS[v][0], VIEWS[v][1], VIEWS[v][2], COLUMNS, ROWS);
+        copyFrameRows(frame, rows, COLUMNS);
+        printf("x %g, y %g, w %g (%d x %d)\n", frame->x, frame->y, frame->w, COLUMNS, ROWS);
+
+        benchKCodec(frame, rows, 1);
+        if (threads > 1) benchKCodec(frame, rows, threads);
+        benchZlib(rows, 1);
+        benchZlib(rows, 6);
+        benchZlib(rows, 9);
+#if defined HAVE_ZSTD
+        benchZstd(rows, 3);
+        benchZstd(rows, 19);
+#endif
+        freeFrame(frame);
+    }
+    free(rows);
+    return 0;
+}
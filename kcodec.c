@@ -0,0 +1,816 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kcodec.h"
+
+/*
+ * Tokens
+ *
+ * 0xxxxxxx           Difference from the prediction, zigzag encoded (0 to 127).
+ * 10xxxxxx           Run of 2 to 65 exact predictions.
+ * 110xxxxx xxxxxxxx  Run of 66 to 8257 exact predictions.
+ * 111xxxxx hi lo     A k value as it is, for big differences.
+ */
+
+#define LITERAL_LIMIT 0x80
+#define SHORT_RUN 0x80
+#define SHORT_RUN_MAX 65
+#define LONG_RUN 0xC0
+#define LONG_RUN_MAX (66 + 0x1FFF)
+#define ABSOLUTE 0xE0
+
+static uint8_t* putRun(uint8_t *out, int run) {
+    while (run > 0) {
+        if (run == 1) {
+            *out++ = 0;
+            run = 0;
+        } else if (run <= SHORT_RUN_MAX) {
+            *out++ = SHORT_RUN | (run - 2);
+            run = 0;
+        } else {
+            int n = run > LONG_RUN_MAX ? LONG_RUN_MAX : run;
+            *out++ = LONG_RUN | (n - 66) >> 8;
+            *out++ = (n - 66) & 0xFF;
+            run -= n;
+        }
+    }
+    return out;
+}
+
+/*
+ * Predictors
+ *
+ * A value is predicted from its neighbours to the
+ * left (a), above (b) and above to the left (c). At
+ * the start of a row the prediction is the value
+ * above, and along the first row of a tile the value
+ * to the left (or 0 to start with).
+ */
+
+enum Predictor {
+    PREDICT_LEFT,     // a
+    PREDICT_UP,       // b
+    PREDICT_GRADIENT, // Median of a, b and a + b - c, which follows band edges either way.
+    PREDICTORS
+};
+
+static inline int predictK(enum Predictor predictor, const unsigned short *row, const unsigned short *above, int r) {
+    if (!above) return r > 0 ? row[r - 1] : 0;
+    if (r == 0) return above[0];
+
+    int a = row[r - 1];
+    int b = above[r];
+    if (predictor == PREDICT_LEFT) return a;
+    if (predictor == PREDICT_UP) return b;
+    int c = above[r - 1];
+    int lower = a < b ? a : b;
+    int upper = a < b ? b : a;
+    if (c >= upper) return lower;
+    if (c <= lower) return upper;
+    return a + b - c;
+}
+
+/*
+ * Turn the k values of a tile into tokens, row by
+ * row, predicting each with the given predictor.
+ * The tile must lie within one of the frame's tiles.
+ * Returns the number of bytes written, at most
+ * PACKED_TILE_BOUND.
+ */
+static size_t tokenizeTile(struct Frame *frame, struct Tile tile, enum Predictor predictor, uint8_t *out) {
+    uint8_t *start = out;
+    int run = 0;
+    const unsigned short *above = NULL;
+
+    for (int i = tile.y; i < tile.y + tile.h; i++) {
+        const unsigned short *row = &FRAME_K(frame, tile.x, i);
+        for (int r = 0; r < tile.w; r++) {
+            int value = row[r];
+            int difference = value - predictK(predictor, row, above, r);
+
+            if (difference == 0) {
+                run++;
+                continue;
+            }
+            out = putRun(out, run);
+            run = 0;
+
+            unsigned zigzag = difference < 0 ? -2*difference - 1 : 2*difference;
+            if (zigzag < LITERAL_LIMIT) {
+                *out++ = zigzag;
+            } else {
+                *out++ = ABSOLUTE;
+                *out++ = value >> 8;
+                *out++ = value & 0xFF;
+            }
+        }
+        above = row;
+    }
+    out = putRun(out, run);
+    return out - start;
+}
+
+/*
+ * Turn tokens made by tokenizeTile back into the k
+ * values of a tile. Returns 0, or -1 if they do not
+ * decode to exactly one tile.
+ */
+static int detokenizeTile(const uint8_t *in, size_t size, struct Tile tile, enum Predictor predictor, struct Frame *frame) {
+    const uint8_t *end = in + size;
+    int run = 0;
+    const unsigned short *above = NULL;
+
+    for (int i = tile.y; i < tile.y + tile.h; i++) {
+        unsigned short *row = &FRAME_K(frame, tile.x, i);
+        int r = 0;
+        while (r < tile.w) {
+            // Fill in as much of a run as falls in this row at once
+            if (run > 0) {
+                int n = run < tile.w - r ? run : tile.w - r;
+                run -= n;
+                if (above && r == 0) {
+                    row[r] = above[0];
+                    r++;
+                    n--;
+                }
+                if (!above || predictor == PREDICT_LEFT) {
+                    unsigned short value = r > 0 ? row[r - 1] : 0;
+                    for (int e = r + n; r < e; r++) row[r] = value;
+                } else if (predictor == PREDICT_UP) {
+                    memcpy(row + r, above + r, n * sizeof(unsigned short));
+                    r += n;
+                } else {
+                    for (int e = r + n; r < e; r++) row[r] = predictK(predictor, row, above, r);
+                }
+                continue;
+            }
+
+            if (in >= end) return -1;
+            uint8_t token = *in++;
+            if (token < LITERAL_LIMIT) {
+                int value = predictK(predictor, row, above, r);
+                row[r++] = value + ((token >> 1) ^ -(token & 1)); // Undo the zigzag
+            } else if (token < LONG_RUN) {
+                run = (token & 0x3F) + 2;
+            } else if (token < ABSOLUTE) {
+                if (in >= end) return -1;
+                run = ((token & 0x1F) << 8 | *in++) + 66;
+            } else {
+                if (end - in < 2) return -1;
+                row[r++] = in[0] << 8 | in[1];
+                in += 2;
+            }
+        }
+        above = row;
+    }
+    return run == 0 && in == end ? 0 : -1;
+}
+
+/*
+ * Pack the k values of a tile, predicting each from
+ * its neighbour to the left, which is the quickest.
+ * The tile must lie within one of the frame's tiles.
+ * Returns the number of bytes written, at most
+ * PACKED_TILE_BOUND.
+ */
+size_t packTile(struct Frame *frame, struct Tile tile, uint8_t *out) {
+    return tokenizeTile(frame, tile, PREDICT_LEFT, out);
+}
+
+/*
+ * Unpack the k values of a tile packed by packTile.
+ * Returns 0, or -1 if the data does not decode to
+ * exactly one tile.
+ */
+int unpackTile(const uint8_t *in, size_t size, struct Tile tile, struct Frame *frame) {
+    return detokenizeTile(in, size, tile, PREDICT_LEFT, frame);
+}
+
+/*
+ * Pack the sampled part of a frame's k values into a
+ * newly allocated PackedK, or return NULL if out of
+ * memory. Tiles are packed on the stack and copied
+ * over, so that the PackedK only ever grows to about
+ * the size it ends up.
+ */
+struct PackedK* packK(struct Frame *frame) {
+    int tiles = frameTiles(frame);
+    struct PackedK *packed = malloc(sizeof(struct PackedK) + (tiles + 1) * sizeof(size_t));
+    if (!packed) return NULL;
+    size_t capacity = 4 * PACKED_TILE_BOUND;
+    packed->tiles = tiles;
+    packed->data = malloc(capacity);
+    if (!packed->data) {
+        free(packed);
+        return NULL;
+    }
+
+    uint8_t tile[PACKED_TILE_BOUND];
+    size_t size = 0;
+    for (int t = 0; t < tiles; t++) {
+        size_t length = packTile(frame, frameTile(frame, t), tile);
+        if (size + length > capacity) {
+            capacity *= 2;
+            uint8_t *grown = realloc(packed->data, capacity);
+            if (!grown) {
+                freePackedK(packed);
+                return NULL;
+            }
+            packed->data = grown;
+        }
+        packed->offsets[t] = size;
+        memcpy(packed->data + size, tile, length);
+        size += length;
+    }
+    packed->offsets[tiles] = size;
+    return packed;
+}
+
+// Memory taken by packed k values (bytes).
+long packedSize(const struct PackedK *packed) {
+    return sizeof(struct PackedK) + (packed->tiles + 1) * sizeof(size_t) + packed->offsets[packed->tiles];
+}
+
+void freePackedK(struct PackedK *packed) {
+    if (!packed) return;
+    free(packed->data);
+    free(packed);
+}
+
+/*
+ * Tile Workers
+ */
+
+struct TileWork {
+    void (*work)(void*, int); // Called with arg for each tile.
+    void *arg;
+    int tiles;
+    atomic_int nextTile;
+};
+
+#if !defined SINGLE_THREADED
+static void* tileThread(void *arg) {
+    struct TileWork *tileWork = arg;
+    int t;
+    while ((t = atomic_fetch_add(&tileWork->nextTile, 1)) < tileWork->tiles) {
+        tileWork->work(tileWork->arg, t);
+    }
+    return NULL;
+}
+#endif
+
+/*
+ * Call work for each of the given number of tiles,
+ * with up to the given number of threads picking up
+ * tiles side by side (the caller being one).
+ */
+static void forEachTile(int tiles, int threads, void (*work)(void*, int), void *arg) {
+#if !defined SINGLE_THREADED
+    if (threads > 1) {
+        pthread_t workers[MAX_THREADS];
+        struct TileWork tileWork = { work, arg, tiles };
+        atomic_init(&tileWork.nextTile, 0);
+
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+        int started = 0;
+        for (; started < threads - 1; started++) {
+            if (pthread_create(&workers[started], NULL, tileThread, &tileWork) != 0) break;
+        }
+        tileThread(&tileWork); // Lend a hand
+        for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+        return;
+    }
+#endif
+    for (int t = 0; t < tiles; t++) work(arg, t);
+}
+
+struct Unpacking {
+    const struct PackedK *packed;
+    struct Frame *frame;
+    atomic_int failed;
+};
+
+static void unpackWork(void *arg, int t) {
+    struct Unpacking *unpacking = arg;
+    const struct PackedK *packed = unpacking->packed;
+    size_t size = packed->offsets[t + 1] - packed->offsets[t];
+    struct Tile tile = frameTile(unpacking->frame, t);
+    if (unpackTile(packed->data + packed->offsets[t], size, tile, unpacking->frame) != 0) {
+        atomic_store(&unpacking->failed, 1);
+    }
+}
+
+/*
+ * Unpack the k values of a frame packed by packK,
+ * with up to the given number of threads working on
+ * tiles side by side. Returns 0, or -1 if the data
+ * is corrupt.
+ */
+int unpackK(const struct PackedK *packed, struct Frame *frame, int threads) {
+    if (packed->tiles != frameTiles(frame)) return -1;
+    struct Unpacking unpacking = { packed, frame };
+    atomic_init(&unpacking.failed, 0);
+    forEachTile(packed->tiles, threads, unpackWork, &unpacking);
+    return atomic_load(&unpacking.failed) ? -1 : 0;
+}
+
+/*
+ * Entropy Coding
+ *
+ * For archiving, the tokens of every tile are coded
+ * again with a canonical Huffman code built from the
+ * token counts of the whole frame, so that the common
+ * tokens (short runs, differences of one or two) take
+ * a few bits rather than a byte. Codes are at most
+ * CODE_BITS long, so that a token is decoded with one
+ * table lookup, and where the next CODE_BITS bits hold
+ * two whole codes (the common tokens are short) the
+ * lookup gives both.
+ */
+
+#define CODE_BITS 12
+#define SYMBOLS 256
+
+struct HuffmanCode {
+    uint8_t lengths[SYMBOLS];
+    uint16_t codes[SYMBOLS];
+    uint32_t table[1 << CODE_BITS]; // Decoded tokens, by the next CODE_BITS bits.
+};
+
+// Fields of a decoding table entry: the first token and the length of its
+// code, the second token if there is one, and the tokens and bits they take.
+#define ENTRY_FIRST(entry) ((entry) & 0xFF)
+#define ENTRY_SECOND(entry) ((entry) >> 8 & 0xFF)
+#define ENTRY_LENGTH(entry) ((entry) >> 16 & 0xF)
+#define ENTRY_USED_LENGTH(entry) ((entry) >> 20 & 0x1F)
+#define ENTRY_TOKENS(entry) ((entry) >> 25)
+#define SINGLE_ENTRY(symbol, length) ((symbol) | (length) << 16 | (length) << 20 | 1u << 25)
+
+/*
+ * Work out Huffman code lengths for the given symbol
+ * counts, flattening the counts until no code is
+ * longer than CODE_BITS.
+ */
+static void buildLengths(const long *counts, uint8_t *lengths) {
+    long weights[2 * SYMBOLS];
+    int parents[2 * SYMBOLS];
+    long scaled[SYMBOLS];
+    memcpy(scaled, counts, sizeof(scaled));
+
+    for (;;) {
+        int nodes = 0;
+        int leaves[SYMBOLS];
+        for (int s = 0; s < SYMBOLS; s++) {
+            lengths[s] = 0;
+            if (scaled[s] == 0) continue;
+            leaves[nodes] = s;
+            weights[nodes] = scaled[s];
+            parents[nodes] = -1;
+            nodes++;
+        }
+        int symbols = nodes;
+        if (symbols == 1) {
+            lengths[leaves[0]] = 1;
+            return;
+        }
+
+        // Join the two lightest parentless nodes until one is left
+        for (int joins = 0; joins < symbols - 1; joins++) {
+            int lightest = -1;
+            int second = -1;
+            for (int n = 0; n < nodes; n++) {
+                if (parents[n] >= 0) continue;
+                if (lightest < 0 || weights[n] < weights[lightest]) {
+                    second = lightest;
+                    lightest = n;
+                } else if (second < 0 || weights[n] < weights[second]) {
+                    second = n;
+                }
+            }
+            weights[nodes] = weights[lightest] + weights[second];
+            parents[nodes] = -1;
+            parents[lightest] = nodes;
+            parents[second] = nodes;
+            nodes++;
+        }
+
+        int longest = 0;
+        for (int n = 0; n < symbols; n++) {
+            int length = 0;
+            for (int p = n; parents[p] >= 0; p = parents[p]) length++;
+            lengths[leaves[n]] = length;
+            if (length > longest) longest = length;
+        }
+        if (longest <= CODE_BITS) return;
+        for (int s = 0; s < SYMBOLS; s++) {
+            if (scaled[s]) scaled[s] = scaled[s] / 2 + 1;
+        }
+    }
+}
+
+/*
+ * Assign canonical codes for the code lengths, and
+ * fill in the decoding table. Returns 0, or -1 if
+ * the lengths do not make a valid code.
+ */
+static int buildCode(struct HuffmanCode *code) {
+    int count[CODE_BITS + 1] = { 0 };
+    for (int s = 0; s < SYMBOLS; s++) {
+        if (code->lengths[s] > CODE_BITS) return -1;
+        count[code->lengths[s]]++;
+    }
+    count[0] = 0;
+
+    int next[CODE_BITS + 1];
+    int value = 0;
+    for (int length = 1; length <= CODE_BITS; length++) {
+        value = (value + count[length - 1]) << 1;
+        next[length] = value;
+    }
+
+    memset(code->table, 0, sizeof(code->table));
+    for (int s = 0; s < SYMBOLS; s++) {
+        int length = code->lengths[s];
+        if (length == 0) continue;
+        code->codes[s] = next[length]++;
+        if (code->codes[s] >= 1 << length) return -1; // Oversubscribed
+
+        int first = code->codes[s] << (CODE_BITS - length);
+        for (int e = 0; e < 1 << (CODE_BITS - length); e++) {
+            code->table[first + e] = SINGLE_ENTRY(s, length);
+        }
+    }
+
+    // Pair up codes that fit in the bits looked up together
+    for (int e = 0; e < 1 << CODE_BITS; e++) {
+        uint32_t entry = code->table[e];
+        int length = ENTRY_LENGTH(entry);
+        if (length == 0) continue;
+        uint32_t next = code->table[(e << length) & ((1 << CODE_BITS) - 1)];
+        int both = length + ENTRY_LENGTH(next);
+        if (ENTRY_LENGTH(next) == 0 || both > CODE_BITS) continue;
+        code->table[e] = ENTRY_FIRST(entry) | ENTRY_FIRST(next) << 8 | length << 16 | both << 20 | 2u << 25;
+    }
+    return 0;
+}
+
+struct BitWriter {
+    uint8_t *out;
+    uint64_t bits;
+    int count; // Bits in bits not yet written out.
+};
+
+static inline void putBits(struct BitWriter *writer, unsigned value, int length) {
+    writer->bits = writer->bits << length | value;
+    writer->count += length;
+    while (writer->count >= 8) {
+        writer->count -= 8;
+        *writer->out++ = writer->bits >> writer->count;
+    }
+}
+
+struct BitReader {
+    const uint8_t *in;
+    const uint8_t *end;
+    uint64_t bits;  // Next bits, starting from the top.
+    int count;      // Of which are valid.
+    long overrun;   // Bits read past the end.
+};
+
+static inline void refillBits(struct BitReader *reader) {
+    // Take whole bytes with one load while there are 8 left to read
+    if (reader->end - reader->in >= 8) {
+        uint64_t next;
+        memcpy(&next, reader->in, sizeof(next));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        next = __builtin_bswap64(next);
+#endif
+        reader->bits |= next >> reader->count;
+        reader->in += (63 - reader->count) >> 3;
+        reader->count |= 56;
+        return;
+    }
+    while (reader->count <= 56) {
+        uint64_t byte = 0;
+        if (reader->in < reader->end) {
+            byte = *reader->in++;
+        } else {
+            reader->overrun += 8;
+        }
+        reader->bits |= byte << (56 - reader->count);
+        reader->count += 8;
+    }
+}
+
+/*
+ * Archive Format
+ *
+ *     "KPK2", columns, rows (32 bit little-endian)
+ *     x, y, w (64 bit IEEE 754, little-endian)
+ *     iteration cap, minimum k value (32 bit little-endian)
+ *     Huffman code lengths, 4 bits per symbol
+ *     for each tile: predictor (8 bit), tokens and
+ *         coded bytes (32 bit little-endian)
+ *     coded tiles, one after the other
+ */
+
+#define ARCHIVE_MAGIC "KPK2"
+#define ARCHIVE_FRAME_HEADER 44
+#define ARCHIVE_TILE_HEADER 9
+
+static void putLE32(uint8_t *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+static uint32_t getLE32(const uint8_t *in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t) in[3] << 24;
+}
+static void putDouble(uint8_t *out, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    putLE32(out, bits);
+    putLE32(out + 4, bits >> 32);
+}
+static double getDouble(const uint8_t *in) {
+    uint64_t bits = getLE32(in) | (uint64_t) getLE32(in + 4) << 32;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static size_t archiveHeader(int tiles) {
+    return ARCHIVE_FRAME_HEADER + SYMBOLS / 2 + (size_t) tiles * ARCHIVE_TILE_HEADER;
+}
+
+struct Encoding {
+    struct Frame *frame;
+    uint8_t *tokens;         // PACKED_TILE_BOUND bytes per tile.
+    size_t *tokenCounts;
+    uint8_t *predictors;
+    long (*counts)[SYMBOLS]; // Token counts per tile.
+    struct HuffmanCode *code;
+    uint8_t *coded;          // CODED_TILE_BOUND bytes per tile.
+    size_t *codedSizes;
+};
+
+// Tokens below which a tile is not worth trying other predictors on.
+#define TINY_TILE 16
+
+// Largest number of bytes the tokens of a tile can be coded into.
+#define CODED_TILE_BOUND (PACKED_TILE_BOUND * CODE_BITS / 8 + 8)
+
+/*
+ * Tokenize a tile with whichever predictor gives the
+ * fewest tokens, and count them.
+ */
+static void tokenizeWork(void *arg, int t) {
+    struct Encoding *encoding = arg;
+    struct Tile tile = frameTile(encoding->frame, t);
+    uint8_t *best = encoding->tokens + (size_t) t * PACKED_TILE_BOUND;
+    uint8_t trial[PACKED_TILE_BOUND];
+
+    encoding->predictors[t] = PREDICT_LEFT;
+    encoding->tokenCounts[t] = tokenizeTile(encoding->frame, tile, PREDICT_LEFT, best);
+    // A tile of a few runs (all inside the set, or one band) won't get smaller
+    if (encoding->tokenCounts[t] <= TINY_TILE) goto count;
+    for (int predictor = PREDICT_LEFT + 1; predictor < PREDICTORS; predictor++) {
+        size_t size = tokenizeTile(encoding->frame, tile, predictor, trial);
+        if (size >= encoding->tokenCounts[t]) continue;
+        memcpy(best, trial, size);
+        encoding->tokenCounts[t] = size;
+        encoding->predictors[t] = predictor;
+    }
+
+count:;
+    long *counts = encoding->counts[t];
+    memset(counts, 0, SYMBOLS * sizeof(long));
+    for (size_t b = 0; b < encoding->tokenCounts[t]; b++) counts[best[b]]++;
+}
+
+static void codeWork(void *arg, int t) {
+    struct Encoding *encoding = arg;
+    const uint8_t *tokens = encoding->tokens + (size_t) t * PACKED_TILE_BOUND;
+    uint8_t *start = encoding->coded + (size_t) t * CODED_TILE_BOUND;
+    struct BitWriter writer = { start, 0, 0 };
+    const struct HuffmanCode *code = encoding->code;
+
+    for (size_t b = 0; b < encoding->tokenCounts[t]; b++) {
+        putBits(&writer, code->codes[tokens[b]], code->lengths[tokens[b]]);
+    }
+    if (writer.count > 0) putBits(&writer, 0, 8 - writer.count);
+    encoding->codedSizes[t] = writer.out - start;
+}
+
+/*
+ * Encode the k values of a frame for archiving, with
+ * up to the given number of threads working on tiles
+ * side by side. Returns the encoded frame, newly
+ * allocated, and its size in *size, or NULL if out
+ * of memory.
+ */
+uint8_t* encodeK(struct Frame *frame, int threads, size_t *size) {
+    int tiles = frameTiles(frame);
+    struct HuffmanCode *code = malloc(sizeof(struct HuffmanCode));
+    struct Encoding encoding = {
+        frame,
+        malloc((size_t) tiles * PACKED_TILE_BOUND),
+        malloc(tiles * sizeof(size_t)),
+        malloc(tiles),
+        malloc(tiles * sizeof(long[SYMBOLS])),
+        code,
+        malloc((size_t) tiles * CODED_TILE_BOUND),
+        malloc(tiles * sizeof(size_t))
+    };
+    uint8_t *out = NULL;
+    if (!code || !encoding.tokens || !encoding.tokenCounts || !encoding.predictors ||
+        !encoding.counts || !encoding.coded || !encoding.codedSizes) goto done;
+
+    // Tokenize the tiles, then build one code for all of them
+    forEachTile(tiles, threads, tokenizeWork, &encoding);
+    long counts[SYMBOLS] = { 0 };
+    for (int t = 0; t < tiles; t++) {
+        for (int s = 0; s < SYMBOLS; s++) counts[s] += encoding.counts[t][s];
+    }
+    buildLengths(counts, code->lengths);
+    if (buildCode(code) != 0) goto done;
+    forEachTile(tiles, threads, codeWork, &encoding);
+
+    // Lay out the header and the coded tiles
+    *size = archiveHeader(tiles);
+    for (int t = 0; t < tiles; t++) *size += encoding.codedSizes[t];
+    out = malloc(*size);
+    if (!out) goto done;
+
+    memcpy(out, ARCHIVE_MAGIC, 4);
+    putLE32(out + 4, frame->columns);
+    putLE32(out + 8, frame->rows);
+    putDouble(out + 12, frame->x);
+    putDouble(out + 20, frame->y);
+    putDouble(out + 28, frame->w);
+    putLE32(out + 36, frame->maxK);
+    putLE32(out + 40, (uint32_t) (int) frame->min);
+    for (int s = 0; s < SYMBOLS; s += 2) {
+        out[ARCHIVE_FRAME_HEADER + s / 2] = code->lengths[s] | code->lengths[s + 1] << 4;
+    }
+    uint8_t *tileHeader = out + ARCHIVE_FRAME_HEADER + SYMBOLS / 2;
+    uint8_t *data = out + archiveHeader(tiles);
+    for (int t = 0; t < tiles; t++, tileHeader += ARCHIVE_TILE_HEADER) {
+        tileHeader[0] = encoding.predictors[t];
+        putLE32(tileHeader + 1, encoding.tokenCounts[t]);
+        putLE32(tileHeader + 5, encoding.codedSizes[t]);
+        memcpy(data, encoding.coded + (size_t) t * CODED_TILE_BOUND, encoding.codedSizes[t]);
+        data += encoding.codedSizes[t];
+    }
+
+done:
+    free(code);
+    free(encoding.tokens);
+    free(encoding.tokenCounts);
+    free(encoding.predictors);
+    free(encoding.counts);
+    free(encoding.coded);
+    free(encoding.codedSizes);
+    return out;
+}
+
+/*
+ * The number of columns and rows of a frame encoded
+ * by encodeK. Returns 0, or -1 if it is not one.
+ */
+int encodedFrameSize(const uint8_t *in, size_t size, int *columns, int *rows) {
+    if (size < ARCHIVE_FRAME_HEADER || memcmp(in, ARCHIVE_MAGIC, 4) != 0) return -1;
+    *columns = getLE32(in + 4);
+    *rows = getLE32(in + 8);
+    return *columns > 0 && *rows > 0 ? 0 : -1;
+}
+
+struct Decoding {
+    struct Frame *frame;
+    const struct HuffmanCode *code;
+    const uint8_t *tileHeaders;
+    const uint8_t **tileData;
+    atomic_int failed;
+};
+
+static void decodeWork(void *arg, int t) {
+    struct Decoding *decoding = arg;
+    const uint8_t *tileHeader = decoding->tileHeaders + (size_t) t * ARCHIVE_TILE_HEADER;
+    int predictor = tileHeader[0];
+    size_t tokenCount = getLE32(tileHeader + 1);
+    size_t codedSize = getLE32(tileHeader + 5);
+    if (predictor >= PREDICTORS || tokenCount > PACKED_TILE_BOUND) {
+        atomic_store(&decoding->failed, 1);
+        return;
+    }
+
+    // Decode the tokens, then the k values from them
+    uint8_t tokens[PACKED_TILE_BOUND + 1]; // And one written past the last.
+    const uint32_t *table = decoding->code->table;
+    struct BitReader reader = { decoding->tileData[t], decoding->tileData[t] + codedSize, 0, 0, 0 };
+    size_t b = 0;
+    while (b + 1 < tokenCount) {
+        // Taking one token or two without branching on which
+        if (reader.count < CODE_BITS) refillBits(&reader);
+        uint32_t entry = table[reader.bits >> (64 - CODE_BITS)];
+        if (entry == 0) break; // Not a code
+        tokens[b] = ENTRY_FIRST(entry);
+        tokens[b + 1] = ENTRY_SECOND(entry);
+        b += ENTRY_TOKENS(entry);
+        reader.bits <<= ENTRY_USED_LENGTH(entry);
+        reader.count -= ENTRY_USED_LENGTH(entry);
+    }
+    if (b + 1 == tokenCount) {
+        // The last token alone, as it may be paired with bits past the end
+        if (reader.count < CODE_BITS) refillBits(&reader);
+        uint32_t entry = table[reader.bits >> (64 - CODE_BITS)];
+        if (entry != 0) {
+            tokens[b++] = ENTRY_FIRST(entry);
+            reader.bits <<= ENTRY_LENGTH(entry);
+            reader.count -= ENTRY_LENGTH(entry);
+        }
+    }
+    long unread = (long) (reader.end - reader.in) * 8 + reader.count - reader.overrun;
+    int result = detokenizeTile(tokens, tokenCount, frameTile(decoding->frame, t), predictor, decoding->frame);
+    if (b < tokenCount || unread < 0 || unread >= 8 || result != 0) {
+        atomic_store(&decoding->failed, 1);
+    }
+}
+
+/*
+ * Decode a frame encoded by encodeK into the k values
+ * of a frame of the same size, with up to the given
+ * number of threads working on tiles side by side,
+ * and give the frame the viewport, iteration cap and
+ * minimum k value it was encoded with, rendered in
+ * full. Returns 0, or -1 if the data is corrupt.
+ */
+int decodeK(const uint8_t *in, size_t size, struct Frame *frame, int threads) {
+    int columns, rows;
+    if (encodedFrameSize(in, size, &columns, &rows) != 0) return -1;
+    if (columns != frame->columns || rows != frame->rows) return -1;
+    int tiles = frameTiles(frame);
+    if (size < archiveHeader(tiles)) return -1;
+    int maxK = getLE32(in + 36);
+    int min = getLE32(in + 40);
+    if (maxK < 1 || maxK > MAX_K || min < 0 || min > maxK + 1) return -1;
+    double w = getDouble(in + 28);
+    if (!isfinite(getDouble(in + 12)) || !isfinite(getDouble(in + 20)) || !(w > 0 && w < INFINITY)) return -1;
+
+    struct HuffmanCode *code = malloc(sizeof(struct HuffmanCode));
+    const uint8_t **tileData = malloc(tiles * sizeof(uint8_t*));
+    int result = -1;
+    if (!code || !tileData) goto done;
+    for (int s = 0; s < SYMBOLS; s += 2) {
+        code->lengths[s] = in[ARCHIVE_FRAME_HEADER + s / 2] & 0xF;
+        code->lengths[s + 1] = in[ARCHIVE_FRAME_HEADER + s / 2] >> 4;
+    }
+    if (buildCode(code) != 0) goto done;
+
+    // Find where each tile starts
+    const uint8_t *tileHeaders = in + ARCHIVE_FRAME_HEADER + SYMBOLS / 2;
+    size_t offset = archiveHeader(tiles);
+    for (int t = 0; t < tiles; t++) {
+        size_t codedSize = getLE32(tileHeaders + (size_t) t * ARCHIVE_TILE_HEADER + 5);
+        if (codedSize > size - offset) goto done;
+        tileData[t] = in + offset;
+        offset += codedSize;
+    }
+
+    struct Decoding decoding = { frame, code, tileHeaders, tileData };
+    atomic_init(&decoding.failed, 0);
+    forEachTile(tiles, threads, decodeWork, &decoding);
+    result = atomic_load(&decoding.failed) ? -1 : 0;
+    if (result == 0) {
+        frame->x = getDouble(in + 12);
+        frame->y = getDouble(in + 20);
+        frame->w = w;
+        frame->maxK = maxK;
+        frame->min = min;
+        frame->scale = 1;
+    }
+
+done:
+    free(code);
+    free(tileData);
+    return result;
+}
+
+/*
+ * Decode a frame encoded by encodeK into a new frame,
+ * as decodeK does, not yet linked into the history
+ * tree. Returns NULL if the data is corrupt or if out
+ * of memory.
+ */
+struct Frame* decodeFrame(const uint8_t *in, size_t size, int threads) {
+    int columns, rows;
+    if (encodedFrameSize(in, size, &columns, &rows) != 0) return NULL;
+    struct Frame *frame = newFrame(NULL, 0, 0, 1, columns, rows);
+    if (frame && decodeK(in, size, frame, threads) != 0) {
+        discardFrame(frame);
+        return NULL;
+    }
+    return frame;
+}
@@ -0,0 +1,56 @@
+#ifndef KCODEC_H
+#define KCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+/*
+ * K Value Codec
+ *
+ * Compresses the k values of a frame, one tile at a
+ * time so that tiles can be packed and unpacked
+ * independently (and in parallel). Each value is
+ * predicted from its neighbours, and the differences
+ * are written as single bytes where small, with runs
+ * of exact predictions (the inside of the set, or the
+ * wide bands away from it) collapsed into one or two
+ * bytes.
+ *
+ * packK keeps frames in memory, and predicts each
+ * value from its neighbour to the left (or above at
+ * the start of a row), which is the fastest to undo.
+ * encodeK is for frames going to disk: each tile is
+ * predicted whichever of three ways suits it best,
+ * and its bytes are then Huffman coded, for about a
+ * third less again. An encoded frame also records
+ * its viewport, iteration cap and minimum k value,
+ * so that decodeFrame gives back a frame that can be
+ * colored in and browsed like a rendered one.
+ */
+
+// Largest number of bytes a tile can pack into.
+#define PACKED_TILE_BOUND (3 * TILE_SIZE * TILE_SIZE)
+
+// The packed k values of a whole frame.
+struct PackedK {
+    int tiles;
+    uint8_t *data;
+    size_t offsets[]; // Start of each tile in data, then the end.
+};
+
+size_t packTile(struct Frame*, struct Tile, uint8_t*);
+int unpackTile(const uint8_t*, size_t, struct Tile, struct Frame*);
+
+struct PackedK* packK(struct Frame*);
+int unpackK(const struct PackedK*, struct Frame*, int);
+long packedSize(const struct PackedK*);
+void freePackedK(struct PackedK*);
+
+uint8_t* encodeK(struct Frame*, int, size_t*);
+int decodeK(const uint8_t*, size_t, struct Frame*, int);
+int encodedFrameSize(const uint8_t*, size_t, int*, int*);
+struct Frame* decodeFrame(const uint8_t*, size_t, int);
+
+#endif
@@ -1,56 +1,63 @@
+/*
+ * To build and run: `gcc mandelbrot.c frame.c palette.c kcodec.c tilecache.c checkpoint.c export.c complex.c -lm -lpthread -lz -lSDL2 -lSDL2_ttf -o mandelbrot && ./mandelbrot`
+ * (must be done in the root project folder)
+ *
+ * Add -DSINGLE_THREADED to build without worker threads; frames are
+ * then rendered cooperatively on the main thread, in time slices.
+ */
 
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "complex.h"
+#include "checkpoint.h"
+#include "export.h"
+#include "frame.h"
+#include "palette.h"
+#include "tilecache.h"
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
-/*
- * The Frame struct stores a single frame of the
- * Mandelbrot set. A frame is defined as the k
- * values at all points in the 580 x 406 grid
- * given an origin point and width. Depending on
- * the width, frames may be at different levels
- * of magnification.
- *
- * Frames also can have pointers to parents and
- * children, which are zoomed out or zoomed in
- * from the current frame, respectively.
- */
-
-// Width and Height of a single mandelbrot set frame.
-#define FRAME_WIDTH 580
-#define FRAME_HEIGHT 406
-
-struct Frame {
-    struct Frame *parent;
-    struct Frame *child;
-
-    unsigned short k[FRAME_WIDTH][FRAME_HEIGHT]; // Values of k at each point.
-    double min; // Minimum k value in this frame.
-
-    // The origin is the bottom-left corner.
-    double x; // Origin on the x axis.
-    double y; // Origin on the y axis.
-
-    double w; // Width.
-};
-
-struct Frame* renderFrame(struct Frame*, double, double, double);
-void freeFrame(struct Frame*);
-
 /*
  * Graphics
  */
 
-// Width and Height of the window.
+// Initial Width and Height of the window.
 const int SCREEN_WIDTH = 700;
 const int SCREEN_HEIGHT = 500;
 
+// Space around the frame data for the border, axis labels and frame
+// info. The frame data takes up the rest of the window.
+const int MARGIN_LEFT = 51;
+const int MARGIN_TOP = 15;
+const int MARGIN_RIGHT = 70;
+const int MARGIN_BOTTOM = 80;
+
+// Smallest frame data the window can be resized down to.
+const int MIN_COLUMNS = 128;
+const int MIN_ROWS = 64;
+
+// A viewport on the complex plane, given the same way as for a Frame.
+struct View {
+    double x;
+    double y;
+    double w;
+    int columns;
+    int rows;
+};
+
+// Characters that can be printed, from the glyph atlas.
+#define FIRST_GLYPH ' '
+#define LAST_GLYPH '~'
+#define GLYPH_COUNT (LAST_GLYPH - FIRST_GLYPH + 1)
+
+struct Glyph {
+    SDL_Rect rect; // Area of the glyph atlas holding the glyph.
+    int offset;    // Where it is drawn relative to the pen position.
+    int advance;   // How far it moves the pen position.
+};
 
 struct Display {
     SDL_Window *window;
@@ -58,11 +65,40 @@ struct Display {
     TTF_Font *font;
     SDL_Color color;
     SDL_Point position;
+    int width;                      // Size of the window.
+    int height;
+    SDL_Rect data;                  // Where frame data goes, inside the border.
+
+    SDL_Texture *glyphTexture;      // Glyph atlas, rendered in white.
+    struct Glyph glyphs[GLYPH_COUNT];
+    SDL_Texture *chromeTexture;     // Frame border and axis labels.
+
+    SDL_Texture *frameTexture;      // Frame data as colored in by displayFrameData, one pixel per point.
+    SDL_Texture *zoomTextures[2];   // Frame data as composed by rebaseZoom.
+    SDL_Texture *liveTexture;       // Tiles of the render in progress.
+    SDL_Texture *cachedTexture;     // Whichever of the above was displayed last.
+    SDL_Texture *screenTexture;     // Whole screen as last drawn by displayFrame.
+    struct View cached;             // Viewport of the image in cachedTexture.
+    struct ColorTable table;        // Colors for frameTexture.
+    unsigned short *index;          // Index image of the frame in frameTexture.
+    int indexColumns;               // Size of that index image.
+    int indexRows;
+    long indexCapacity;             // Entries of index allocated.
+    short indexMin;                 // Minimum k value of that frame.
+    short cycling;                  // Whether the colors are being cycled.
+    int phase;                      // How far they have been cycled.
+    int tilesShown;                 // Tiles uploaded into liveTexture so far.
+    short stale;                    // Whether uploaded tiles await presenting.
+    SDL_Rect zoomRect;              // Zoom rectangle drawn over a render in progress, if w > 0.
+    Uint32 presentedAt;             // When the screen was last presented.
 };
 
 struct Display* createDisplay();
+void layoutDisplay(struct Display*, int, int);
+void fitTexture(struct Display*, SDL_Texture**, int, int);
 void destroyDisplay(struct Display*);
 void destroyDisplayAndExit(struct Display*, char*, const char*);
+void loadGlyphs(struct Display*);
 void setColor(struct Display*, Uint8, Uint8, Uint8);
 void setPosition(struct Display*, int, int);
 void printText(struct Display*, char*);
@@ -73,55 +109,125 @@ void colorPixel(struct Display*, int, int);
  * Displaying Frames
  */
 
-const SDL_Point FRAME_ORIGIN = { 50, 14 };
 short useMin = 1;
 
-enum ColorBands {
-    Brown,
-    Violet,
-    Red,
-    RedHi,
-    Orange,
-    YellowLo,
-    Yellow,
-    GreenLo,
-    Green,
-    GreenHi,
-    Cyan,
-    BlueLo,
-    Blue,
-    BlueHi,
-    Magenta,
-    Black
-};
-const SDL_Color colors[] = {
-    [Brown] =    { 171,  87,   0, 255 },
-    [Violet] =   { 255,   0, 127, 255 },  
-    [Red] =      { 171,   0,   0, 255 },
-    [RedHi] =    { 255, 107,   0, 255 },
-    [Orange] =   { 255, 139,   0, 255 },
-    [YellowLo] = { 255, 171,   0, 255 },
-    [Yellow] =   { 255, 255,   0, 255 },
-    [GreenLo] =  { 127, 255,   0, 255 },
-    [Green] =    {   0, 171,   0, 255 },
-    [GreenHi] =  {   0, 255, 127, 255 },
-    [Cyan] =     {   0, 171, 171, 255 },
-    [BlueLo] =   {   0, 127, 255, 255 },
-    [Blue] =     {   0,   0, 171, 255 },
-    [BlueHi] =   { 127,   0, 255, 255 },
-    [Magenta] =  { 171,   0, 171, 255 },
-    [Black] =    {   0,   0,   0, 255 }
-};
+// Change in frame width per notch of the mouse wheel.
+const double WHEEL_ZOOM = 0.8;
+
+// Time allowed for the first image after zooming with the wheel (seconds).
+const double DEFAULT_BUDGET = 0.050;
+
+// Time without input before a coarse frame is refined (milliseconds).
+const Uint32 REFINE_DELAY = 250;
+
+// Minimum time between presenting the progress of a render (milliseconds).
+const Uint32 PRESENT_INTERVAL = 16;
+
+// Colors cycled by each display refresh (k values).
+const int CYCLE_STEP = 1;
+
+// Time a cooperative render runs for between handling input (seconds).
+const double DEFAULT_SLICE = 0.008;
+
+// Disk space the tile cache may take (megabytes).
+const long DEFAULT_TILE_CACHE = 256;
+
+// Time between checks on an export in progress while otherwise idle (milliseconds).
+const Uint32 EXPORT_POLL = 50;
 
 void displayFrame(struct Display*, struct Frame*);
 void displayFrameBorder(struct Display*);
 void displayFrameData(struct Display*, struct Frame*);
+void displayFrameInfo(struct Display*, double, double, double);
+void displayRenderInfo(struct Display*, int, int, int, double);
+void displayFrameColors(struct Display*);
+void colorFrameTexture(struct Display*);
+void displayZoomRect(struct Display*, const SDL_Rect*);
+
+void displayZoom(struct Display*, struct View, struct Render*);
+void displayZoomData(struct Display*, struct View, struct Render*, const SDL_Rect*);
+void displayRenderProgress(struct Display*, struct View, struct Render*);
+int uploadZoomTiles(struct Display*, struct Render*);
+void recolorZoomTiles(struct Display*, struct Render*);
+void reportRender(struct Render*);
+void rebaseZoom(struct Display*, struct View, struct Render*);
+
+struct View frameView(struct Frame*);
+struct Render* goToFrame(struct Display*, struct Frame**, struct Frame*, struct Budget*, struct View*);
+
+void openStartCheckpoint(const char*, double, double, double, int, int);
+int exportStartFrame(const char*, double, double, double, int, int, double);
+struct Export* exportFrame(struct Frame*, int, int, int);
+int reportExport(struct Export*);
 
 int main(int argc, char *argv[]) {
     double x = -2.5;
     double y = -1.25;
     double w = 3.5;
 
+    // Read Options
+    struct Budget budget = { DEFAULT_BUDGET, 0 };
+    double slice = DEFAULT_SLICE;
+    long tileCacheSize = DEFAULT_TILE_CACHE;
+    char *tileCacheDirectory = NULL;
+    char *exportPath = NULL;
+    char *checkpointPath = NULL;
+    int exportColumns = 0; // Size to export frames at, 0 for their own size.
+    int exportRows = 0;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--budget") == 0 && a + 1 < argc) {
+            budget.target = atof(argv[++a]) / 1000;
+        } else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            renderThreads = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--slice") == 0 && a + 1 < argc) {
+            slice = atof(argv[++a]) / 1000;
+        } else if (strcmp(argv[a], "--cache") == 0 && a + 1 < argc) {
+            frameCacheBudget = atol(argv[++a]) * 1024 * 1024;
+        } else if (strcmp(argv[a], "--tile-cache") == 0 && a + 1 < argc) {
+            tileCacheSize = atol(argv[++a]);
+        } else if (strcmp(argv[a], "--tile-cache-dir") == 0 && a + 1 < argc) {
+            tileCacheDirectory = argv[++a];
+        } else if (strcmp(argv[a], "--checkpoint") == 0 && a + 1 < argc) {
+            checkpointPath = argv[++a];
+        } else if (strcmp(argv[a], "--export") == 0 && a + 1 < argc) {
+            exportPath = argv[++a];
+        } else if (strcmp(argv[a], "--export-size") == 0 && a + 1 < argc &&
+                   sscanf(argv[a + 1], "%dx%d", &exportColumns, &exportRows) == 2 && exportColumns > 0 && exportRows > 0) {
+            a++;
+        } else {
+            printf("Usage: %s [--budget milliseconds] [--threads count] [--slice milliseconds] [--cache megabytes]\n", argv[0]);
+            printf("          [--tile-cache megabytes] [--tile-cache-dir directory]\n");
+            printf("          [--checkpoint file] [--export file] [--export-size columnsxrows]\n");
+            printf("  --threads 0 renders cooperatively on the main thread, in slices.\n");
+            printf("  --tile-cache 0 renders every tile instead of keeping them on disk.\n");
+            printf("  --checkpoint keeps the start frame in a file as it renders, to carry on from if stopped.\n");
+            printf("  --export writes the start frame to a PNG (or a PPM, for .ppm) and exits.\n");
+            printf("  --export-size is the size frames are exported at, by default their own.\n");
+            printf("Keys: left/right to go back and forth, m to toggle coloring from the minimum,\n");
+            printf("      c to cycle the colors, s to export the frame to mandelbrot-<n>.png.\n");
+            return 0;
+        }
+    }
+
+    // Open the Tile Cache, carrying on without it if it is unusable
+    if (tileCacheSize > 0) {
+        char *directory = tileCacheDirectory ? strdup(tileCacheDirectory) : defaultTileCacheDirectory();
+        if (directory) tileCache = openTileCache(directory, tileCacheSize * 1024 * 1024);
+        if (!tileCache) printf("Unable to open tile cache%s%s, rendering every tile.\n", directory ? " in " : "", directory ? directory : "");
+        free(directory);
+    }
+
+    // Export the Start Frame without a window, if asked to
+    if (exportPath) {
+        int columns = exportColumns ? exportColumns : SCREEN_WIDTH - MARGIN_LEFT - MARGIN_RIGHT;
+        int rows = exportRows ? exportRows : SCREEN_HEIGHT - MARGIN_TOP - MARGIN_BOTTOM;
+        if (checkpointPath) openStartCheckpoint(checkpointPath, x, y, w, columns, rows);
+        int result = exportStartFrame(exportPath, x, y, w, columns, rows, slice);
+        if (renderCheckpoint) closeCheckpoint(renderCheckpoint);
+        if (tileCache) closeTileCache(tileCache);
+        return result == 0 ? 0 : 1;
+    }
+
     // Set up Window
     struct Display *display = createDisplay();
 
@@ -129,9 +235,32 @@ int main(int argc, char *argv[]) {
     displayFrame(display, NULL);
     SDL_RenderPresent(display->renderer);
 
-    // Render Start Frame (fully zoomed out)
-    struct Frame *start = renderFrame(NULL, x, y, w);
+    // Render Start Frame (fully zoomed out), showing tiles as they complete
+    struct View view = { x, y, w, display->data.w, display->data.h }; // Viewport being rendered.
+    if (checkpointPath) openStartCheckpoint(checkpointPath, x, y, w, view.columns, view.rows);
+    struct Render *render = startRender(NULL, x, y, w, view.columns, view.rows, 1, useMin);
+    if (!render) {
+        destroyDisplayAndExit(display, "Unable to start render", "out of memory or threads");
+    }
+    display->tilesShown = 0;
+    while (!renderDone(render)) {
+        SDL_PumpEvents();
+        if (render->threadCount == 0) {
+            stepRender(render, slice);
+        } else {
+            SDL_Delay(4);
+        }
+        displayRenderProgress(display, view, render);
+    }
+    reportRender(render);
+    recordRender(&budget, render->iterations, render->seconds);
+    struct Frame *start = finishRender(render);
     struct Frame *current = start;
+    render = NULL;
+    if (renderCheckpoint) {
+        closeCheckpoint(renderCheckpoint);
+        renderCheckpoint = NULL;
+    }
     displayFrame(display, current);
     SDL_RenderPresent(display->renderer);
 
@@ -139,26 +268,86 @@ int main(int argc, char *argv[]) {
     SDL_Event e;
     short running = 1;
     short zooming = 0;
+    short dragged = 0; // Whether the zoom rectangle has moved since it was drawn.
     SDL_Point zoomCenter = { 0, 0 };
     SDL_Rect zoom = { 0, 0, 0, 0 };
+    struct Export *exporting = NULL; // Export being written in the background.
+    Uint32 idleSince = SDL_GetTicks();
     while (running) {
-        if (!SDL_WaitEvent(&e)) continue;
-        if (e.type == SDL_QUIT) {
+        // While a frame renders, wake up often to pick up its tiles (or
+        // to render the next slice of a cooperative render), and refine
+        // a coarse frame once input has stopped for a while
+        int hasEvent;
+        if (render) {
+            hasEvent = SDL_WaitEventTimeout(&e, render->threadCount ? 4 : 0);
+        } else if (dragged || (display->cycling && !zooming)) {
+            Uint32 since = SDL_GetTicks() - display->presentedAt;
+            hasEvent = SDL_WaitEventTimeout(&e, since < PRESENT_INTERVAL ? PRESENT_INTERVAL - since : 0);
+        } else if (current->scale > 1 && !zooming) {
+            Uint32 idle = SDL_GetTicks() - idleSince;
+            hasEvent = SDL_WaitEventTimeout(&e, idle < REFINE_DELAY ? REFINE_DELAY - idle : 0);
+        } else if (exporting) {
+            hasEvent = SDL_WaitEventTimeout(&e, EXPORT_POLL);
+        } else {
+            hasEvent = SDL_WaitEvent(&e);
+        }
+        if (hasEvent && e.type != SDL_MOUSEMOTION) idleSince = SDL_GetTicks();
+
+        if (!hasEvent) {
+            // No input, fall through to the render progress below
+        } else if (e.type == SDL_QUIT) {
             running = 0;
+        } else if (e.type == SDL_WINDOWEVENT) {
+            if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                // Lay the window out again around frame data of the new
+                // size, and render the viewport being shown at that size,
+                // keeping its origin and the gap between points
+                struct View from = render ? view : frameView(current);
+                if (render) cancelRender(render);
+                render = NULL;
+                zooming = 0;
+                dragged = 0;
+                display->zoomRect.w = 0;
+                layoutDisplay(display, e.window.data1, e.window.data2);
+                displayFrame(display, current);
+
+                view = from;
+                view.columns = display->data.w;
+                view.rows = display->data.h;
+                view.w = frameGap(from.w, from.columns) * (view.columns + 1);
+                struct Frame *seen = findFrame(view.x, view.y, view.w, view.columns, view.rows, MAX_K);
+                if (seen) {
+                    render = goToFrame(display, &current, seen, &budget, &view);
+                } else {
+                    render = startRender(current, view.x, view.y, view.w, view.columns, view.rows, chooseScale(&budget, current, view.columns, view.rows), useMin);
+                    if (!render) {
+                        printf("Unable to start render.\n");
+                    } else {
+                        display->tilesShown = 0;
+                        displayZoom(display, view, render);
+                    }
+                    SDL_RenderPresent(display->renderer);
+                }
+            }
         } else if (e.type == SDL_KEYDOWN) {
             if (e.key.keysym.sym == SDLK_ESCAPE) {
                 running = 0;
             } else if (e.key.keysym.sym == SDLK_LEFT) {
-                if (current->parent) {
-                    current = current->parent;
+                if (render && !render->refining) {
+                    // Back out of the zoom in progress
+                    cancelRender(render);
+                    render = NULL;
                     displayFrame(display, current);
                     SDL_RenderPresent(display->renderer);
+                } else if (current->parent) {
+                    if (render) cancelRender(render);
+                    render = goToFrame(display, &current, current->parent, &budget, &view);
                 }
             } else if (e.key.keysym.sym == SDLK_RIGHT) {
+                // Forward to the most recently visited child
                 if (current->child) {
-                    current = current->child;
-                    displayFrame(display, current);
-                    SDL_RenderPresent(display->renderer);
+                    if (render) cancelRender(render);
+                    render = goToFrame(display, &current, current->child, &budget, &view);
                 }
             } else if (e.key.keysym.sym == SDLK_EQUALS) {
                 printf("plus\n");
@@ -166,147 +355,244 @@ int main(int argc, char *argv[]) {
                 printf("minus\n");
             } else if (e.key.keysym.sym == SDLK_m) {
                 useMin = !useMin;
-                displayFrame(display, current);
+                if (render) {
+                    // Recolor the tiles rendered so far
+                    atomic_store(&render->useMin, useMin);
+                    recolorZoomTiles(display, render);
+                    displayZoom(display, view, render);
+                } else {
+                    displayFrameColors(display);
+                }
                 SDL_RenderPresent(display->renderer);
+            } else if (e.key.keysym.sym == SDLK_c) {
+                display->cycling = !display->cycling;
+                if (!display->cycling && !render) {
+                    // Back to the colors as they are
+                    display->phase = 0;
+                    displayFrameColors(display);
+                    SDL_RenderPresent(display->renderer);
+                }
+            } else if (e.key.keysym.sym == SDLK_s) {
+                // Export the frame shown (the last finished one, while a
+                // render is in progress), colored as it is
+                if (exporting) {
+                    printf("Still exporting %s.\n", exporting->path);
+                } else {
+                    exporting = exportFrame(current, exportColumns, exportRows, display->phase);
+                }
+            }
+        } else if (e.type == SDL_MOUSEWHEEL) {
+            int mouseX, mouseY;
+            SDL_GetMouseState(&mouseX, &mouseY);
+            double column = mouseX - display->data.x;
+            double row = mouseY - display->data.y;
+            int notches = e.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -e.wheel.y : e.wheel.y;
+
+            if (notches != 0 && !zooming && column >= 0 && column < display->data.w && row >= 0 && row < display->data.h) {
+                // Zoom about the point under the cursor in whatever is on
+                // screen, which may be a frame of another size stretched
+                // over the frame data
+                struct View from = render ? view : frameView(current);
+                double fromGap = frameGap(from.w, from.columns);
+                double pointX = frameReal(from.x, fromGap, column * from.columns / display->data.w);
+                double pointY = frameImag(from.y, fromGap, from.rows, row * from.rows / display->data.h);
+                view.columns = display->data.w;
+                view.rows = display->data.h;
+                double gap = fromGap * from.columns / view.columns * pow(WHEEL_ZOOM, notches);
+                view.w = gap * (view.columns + 1);
+                view.x = pointX - frameReal(0, gap, column);
+                view.y = pointY - frameImag(0, gap, view.rows, row);
+
+                struct Frame *seen = findFrame(view.x, view.y, view.w, view.columns, view.rows, MAX_K);
+                if (seen) {
+                    // Been here recently, no need to render it again
+                    if (render) cancelRender(render);
+                    render = goToFrame(display, &current, seen, &budget, &view);
+                } else {
+                    // Keep what has been rendered so far as the base for the
+                    // reprojection, then start over on the new viewport
+                    if (render) {
+                        rebaseZoom(display, from, render);
+                        cancelRender(render);
+                    }
+                    render = startRender(current, view.x, view.y, view.w, view.columns, view.rows, chooseScale(&budget, current, view.columns, view.rows), useMin);
+                    if (!render) {
+                        printf("Unable to start render.\n");
+                        displayFrame(display, current);
+                    } else {
+                        display->tilesShown = 0;
+                        displayZoom(display, view, render);
+                    }
+                    SDL_RenderPresent(display->renderer);
+                }
             }
         } else if (e.type == SDL_MOUSEBUTTONDOWN) {
+            // A render in progress carries on, with the zoom rectangle
+            // drawn over it as it is shown (see displayRenderProgress)
+
             // Set zoom center
             zoomCenter.x = e.button.x;
             zoomCenter.y = e.button.y;
             zooming = 1;
         } else if (e.type == SDL_MOUSEMOTION) {
-            if (!zooming) continue;
-
-            // Compute zoom rect
-            int diffX = abs(zoomCenter.x - e.motion.x);
-            int diffY = (int) (((float) FRAME_HEIGHT / FRAME_WIDTH) * diffX);
-            if (e.motion.y > zoomCenter.y + diffY || e.motion.y < zoomCenter.y - diffY) {
-                diffY = abs(zoomCenter.y - e.motion.y);
-                diffX = (int) (((float) FRAME_WIDTH / FRAME_HEIGHT) * diffY);
+            if (zooming) {
+                // Compute zoom rect
+                float aspect = (float) (display->data.h + 1) / (display->data.w + 1);
+                int diffX = abs(zoomCenter.x - e.motion.x);
+                int diffY = (int) (aspect * diffX);
+                if (e.motion.y > zoomCenter.y + diffY || e.motion.y < zoomCenter.y - diffY) {
+                    diffY = abs(zoomCenter.y - e.motion.y);
+                    diffX = (int) (diffY / aspect);
+                }
+                zoom.x = zoomCenter.x - diffX;
+                zoom.y = zoomCenter.y - diffY;
+                zoom.w = diffX * 2;
+                zoom.h = diffY * 2;
+
+                // Drawn below, once per display refresh
+                dragged = 1;
             }
-            zoom.x = zoomCenter.x - diffX;
-            zoom.y = zoomCenter.y - diffY;
-            zoom.w = diffX * 2;
-            zoom.h = diffY * 2;
-            
-            displayFrame(display, current);
-            setColor(display, 255, 255, 255);
-            SDL_RenderDrawRect(display->renderer, &zoom);
-            SDL_RenderPresent(display->renderer);
         } else if (e.type == SDL_MOUSEBUTTONUP) {
             // Compute new frame parameters
 
             // Start with pixel coordinates relative to the frame origin
-            double x = (double) zoom.x - FRAME_ORIGIN.x;
-            double y = (double) zoom.y + zoom.h - FRAME_ORIGIN.y;
+            double x = (double) zoom.x - (display->data.x - 1);
+            double y = (double) zoom.y + zoom.h - (display->data.y - 1);
             double w = (double) zoom.w;
-            double gap = current->w / FRAME_WIDTH;
 
-            // Convert pixel coordinates to frame coordinates
-            x = current->x + gap*x;
-            y = current->y + gap*(FRAME_HEIGHT - y);
+            // Convert pixel coordinates to frame coordinates of whatever
+            // is on screen (which may be stretched over the frame data)
+            struct View from = render ? view : frameView(current);
+            double gap = frameGap(from.w, from.columns) * from.columns / display->data.w;
+            x = from.x + gap*x;
+            y = from.y + gap*(display->data.h + 1 - y);
             w = gap*w;
 
-
-            if (w != 0.0) {
-                if (current->child) freeFrame(current->child);
-                current->child = renderFrame(current, x, y, w);
-                current = current->child;
-                displayFrame(display, current);
+            int columns = display->data.w;
+            int rows = display->data.h;
+            struct Frame *seen = w != 0.0 ? findFrame(x, y, w, columns, rows, MAX_K) : NULL;
+            if (seen) {
+                // Been here recently, no need to render it again
+                if (render) cancelRender(render);
+                render = goToFrame(display, &current, seen, &budget, &view);
+            } else if (w != 0.0) {
+                // Render in the background, starting from the zoom rectangle
+                // (over what had been rendered so far, if a render was cut short)
+                if (render) {
+                    rebaseZoom(display, from, render);
+                    cancelRender(render);
+                }
+                view = (struct View) { x, y, w, columns, rows };
+                render = startRender(current, x, y, w, columns, rows, 1, useMin);
+                if (!render) {
+                    printf("Unable to start render.\n");
+                    displayFrame(display, current);
+                } else {
+                    display->tilesShown = 0;
+                    displayZoom(display, view, render);
+                }
                 SDL_RenderPresent(display->renderer);
             }
             
             // Reset
             zooming = 0;
+            dragged = 0;
+            display->zoomRect.w = 0;
             zoom.x = 0;
             zoom.y = 0;
             zoom.w = 0;
             zoom.h = 0;
         }
-    }
 
-    // Clean Up and Exit
-    destroyDisplay(display);
-    display = 0;
-    freeFrame(start);
-    start = 0;
-    current = 0;
-
-    return 0;
-}
+        // Draw the zoom rectangle over the cached screen, coalescing the
+        // motion events that arrive within the same display refresh
+        if (dragged && render) {
+            display->zoomRect = zoom;
+            display->stale = 1;
+            dragged = 0;
+        } else if (dragged && SDL_GetTicks() - display->presentedAt >= PRESENT_INTERVAL) {
+            displayZoomRect(display, &zoom);
+            dragged = 0;
+        }
 
-/*
- * Frame-related Functions
- */
+        // Cycle the colors of a finished frame, once per display refresh.
+        // Only the color table changes, the frame is colored in again
+        // from its index image
+        if (display->cycling && !render && !zooming && SDL_GetTicks() - display->presentedAt >= PRESENT_INTERVAL) {
+            display->phase += CYCLE_STEP;
+            displayFrameColors(display);
+            SDL_RenderPresent(display->renderer);
+            display->presentedAt = SDL_GetTicks();
+        }
 
-struct Frame* renderFrame(struct Frame *parent, double originX, double originY, double frameWidth) {
-    struct Frame *frame = malloc(sizeof(struct Frame));
-    frame->parent = parent;
-    frame->child = NULL;
-    frame->x = originX;
-    frame->y = originY;
-    frame->w = frameWidth;
-
-    // Render frame
-    double gap = frameWidth / FRAME_WIDTH;
-    double r = originX + 4*gap;
-    frame->min = 1000; // Initialize to maximum k value
-
-    for (short x = 0; x <= 578; x++) { // X-axis is the real axis
-        r = r + gap;
-        double i = frame->y + 404*gap;
-        
-        for (short y = 0; y <= 404; y++) {
-            i = i - gap;
-            struct Complex z = { 0.0, 0.0 };
-            struct Complex c = { r, i };
-            double magnitude;
-            
-            short k;
-            for (k = 0; k <= 1000; k++) {
-                /*
-                 * Mandelbrot Equation: Zn+1 = Zn^2 + C
-                 */
-                z = cadd(cmul(z,z), c);
-
-                /**
-                 * Absolute Value of Z, |Z|.
-                 * Absolute Value of N can be formulated as sqrt(N^2)
-                 * For Complex Numbers, this essentially becomes the Distance Formula.
-                 * Distance Formula: SZ^2 = R^2 + I^2
-                 */
-                magnitude = sqrt((z.r * z.r) + (z.i * z.i));
-                if (magnitude > 2) break;
+        // Show the progress of the frame rendering in the background,
+        // once pending input has been handled
+        if (render && !hasEvent && render->threadCount == 0) {
+            stepRender(render, slice);
+        }
+        if (render) {
+            if (renderDone(render)) {
+                reportRender(render);
+                recordRender(&budget, render->iterations, render->seconds);
+                current = finishRender(render);
+                render = NULL;
+                displayFrame(display, current);
+                SDL_RenderPresent(display->renderer);
+                if (zooming && zoom.w > 0) dragged = 1; // Put the zoom rectangle back
+            } else {
+                displayRenderProgress(display, view, render);
             }
-
-            // Todo: use a function pointer to create a callback which allows
-            //       the implementation of a progress bar?
-            
-            frame->k[x][y] = k;
-            if (k < frame->min) frame->min = k;
         }
-    }
 
-    return frame;
-}
+        // Report an export once it is written
+        if (exporting && exportDone(exporting)) {
+            reportExport(exporting);
+            exporting = NULL;
+        }
 
-void freeFrame(struct Frame *frame) {
-    struct Frame *current = frame;
+        // Refine a coarse frame once the user stops interacting
+        if (!render && !zooming && current->scale > 1 && SDL_GetTicks() - idleSince >= REFINE_DELAY) {
+            render = refineFrame(current, useMin);
+            if (render) {
+                view = frameView(current);
+                display->tilesShown = 0;
+            } else {
+                printf("Unable to start render.\n");
+                idleSince = SDL_GetTicks();
+            }
+        }
+    }
 
-    // Find furthest out child
-    while (current->child) current = current->child;
-    
-    // Free all children up to the current frame
-    struct Frame *toFree;
-    while (current != frame) {
-        toFree = current;
-        current = current->parent;
-        free(toFree);
+    // Clean Up and Exit
+    struct FramePoolStats stats = framePoolStats();
+    printf(
+        "Frame buffers: %ld taken, %ld newly allocated (%ld for another size), %ld freed\n",
+        stats.taken,
+        stats.created,
+        stats.resized,
+        stats.released
+    );
+    if (render) cancelRender(render);
+    if (exporting) reportExport(exporting);
+    if (tileCache) {
+        printf(
+            "Tile cache: %ld loaded, %ld missed, %ld stored, %ld evicted\n",
+            atomic_load(&tileCache->hits),
+            atomic_load(&tileCache->misses),
+            atomic_load(&tileCache->stored),
+            atomic_load(&tileCache->evicted)
+        );
+        closeTileCache(tileCache);
+        tileCache = NULL;
     }
+    render = 0;
+    destroyDisplay(display);
+    display = 0;
+    freeFrame(start);
+    start = 0;
+    current = 0;
 
-    // Free the current frame
-    if (frame->parent) frame->parent->child = 0;
-    free(frame);
+    return 0;
 }
 
 /*
@@ -314,7 +600,7 @@ void freeFrame(struct Frame *frame) {
  */
 
 struct Display* createDisplay() {
-    struct Display *display = malloc(sizeof(struct Display));
+    struct Display *display = calloc(1, sizeof(struct Display));
     if (!display) {
         printf("Unable to allocate memory for display.\n");
         exit(0);
@@ -331,11 +617,16 @@ struct Display* createDisplay() {
         SDL_WINDOWPOS_CENTERED,
         SCREEN_WIDTH,
         SCREEN_HEIGHT,
-        0
+        SDL_WINDOW_RESIZABLE
     );
     if (!display->window) {
         destroyDisplayAndExit(display, "Unable to create window", SDL_GetError());
     }
+    SDL_SetWindowMinimumSize(
+        display->window,
+        MARGIN_LEFT + MIN_COLUMNS + MARGIN_RIGHT,
+        MARGIN_TOP + MIN_ROWS + MARGIN_BOTTOM
+    );
     display->renderer = SDL_CreateRenderer(display->window, -1, SDL_RENDERER_ACCELERATED);
     if (!display->renderer) {
         destroyDisplayAndExit(display, "Unable to create renderer", SDL_GetError());
@@ -344,10 +635,104 @@ struct Display* createDisplay() {
     if (!display->font) {
         destroyDisplayAndExit(display, "Unable to load font", TTF_GetError());
     }
+    loadGlyphs(display);
+    display->table.min = -1;
+
+    int width, height;
+    SDL_GetWindowSize(display->window, &width, &height);
+    layoutDisplay(display, width, height);
 
     return display;
 }
+/*
+ * Fit the frame data to a window of the given size
+ * and create the textures that depend on it again.
+ * Textures holding frame data of a given frame are
+ * sized for that frame instead, by fitTexture.
+ */
+void layoutDisplay(struct Display *display, int width, int height) {
+    display->width = width;
+    display->height = height;
+    display->data = (SDL_Rect) {
+        MARGIN_LEFT,
+        MARGIN_TOP,
+        width - MARGIN_LEFT - MARGIN_RIGHT,
+        height - MARGIN_TOP - MARGIN_BOTTOM
+    };
+    if (display->data.w < MIN_COLUMNS) display->data.w = MIN_COLUMNS;
+    if (display->data.h < MIN_ROWS) display->data.h = MIN_ROWS;
+
+    // Textures reprojected zooms are composed into on the GPU, the
+    // screen as drawn by displayFrame, so that the zoom rectangle can
+    // be dragged over it without drawing the frame again, and the
+    // parts of the screen that do not change from frame to frame, so
+    // that each new frame can start from a copy of them
+    SDL_Texture **textures[] = {
+        &display->zoomTextures[0],
+        &display->zoomTextures[1],
+        &display->screenTexture,
+        &display->chromeTexture
+    };
+    for (int t = 0; t < 4; t++) {
+        if (*textures[t]) SDL_DestroyTexture(*textures[t]);
+        *textures[t] = SDL_CreateTexture(
+            display->renderer,
+            SDL_PIXELFORMAT_RGBA8888,
+            SDL_TEXTUREACCESS_TARGET,
+            t < 2 ? display->data.w : width,
+            t < 2 ? display->data.h : height
+        );
+        if (!*textures[t]) {
+            destroyDisplayAndExit(display, "Unable to create screen texture", SDL_GetError());
+        }
+    }
+    fitTexture(display, &display->frameTexture, display->data.w, display->data.h);
+    display->cachedTexture = display->frameTexture;
+
+    SDL_SetRenderTarget(display->renderer, display->chromeTexture);
+    setColor(display, 0, 0, 0);
+    SDL_RenderClear(display->renderer);
+    setColor(display, 255, 255, 255);
+    displayFrameBorder(display);
+    SDL_SetRenderTarget(display->renderer, NULL);
+}
+/*
+ * Make sure a streaming texture of frame data is the
+ * given size, creating it again if it is not.
+ */
+void fitTexture(struct Display *display, SDL_Texture **texture, int width, int height) {
+    int w = 0;
+    int h = 0;
+    if (*texture && SDL_QueryTexture(*texture, NULL, NULL, &w, &h) == 0 && w == width && h == height) return;
+
+    if (*texture) SDL_DestroyTexture(*texture);
+    *texture = SDL_CreateTexture(
+        display->renderer,
+        SDL_PIXELFORMAT_RGBA8888,
+        SDL_TEXTUREACCESS_STREAMING,
+        width,
+        height
+    );
+    if (!*texture) {
+        destroyDisplayAndExit(display, "Unable to create frame texture", SDL_GetError());
+    }
+}
 void destroyDisplay(struct Display *display) {
+    SDL_Texture **textures[] = {
+        &display->frameTexture,
+        &display->zoomTextures[0],
+        &display->zoomTextures[1],
+        &display->liveTexture,
+        &display->screenTexture,
+        &display->chromeTexture,
+        &display->glyphTexture
+    };
+    for (int t = 0; t < 7; t++) {
+        if (*textures[t]) {
+            SDL_DestroyTexture(*textures[t]);
+            *textures[t] = 0;
+        }
+    }
     if (display->window) {
         SDL_DestroyWindow(display->window);
         display->window = 0;
@@ -360,6 +745,8 @@ void destroyDisplay(struct Display *display) {
         TTF_CloseFont(display->font);
         display->font = 0;
     }
+    free(display->index);
+    display->index = 0;
     SDL_Quit();
 }
 void destroyDisplayAndExit(struct Display *display, char *message, const char *errMessage) {
@@ -368,6 +755,55 @@ void destroyDisplayAndExit(struct Display *display, char *message, const char *e
     printf("Exiting.\n");
     exit(0);
 }
+/*
+ * Render each printable character once, in white,
+ * into a single texture. Text is then drawn glyph
+ * by glyph from it, tinted to the current color,
+ * instead of being rendered through SDL_ttf each
+ * time it is printed.
+ */
+void loadGlyphs(struct Display *display) {
+    SDL_Color white = { 255, 255, 255, 255 };
+    SDL_Surface *surfaces[GLYPH_COUNT];
+    int width = 0;
+    int height = TTF_FontHeight(display->font);
+
+    // Render the glyphs, laying them out in a single row
+    for (int g = 0; g < GLYPH_COUNT; g++) {
+        char text[2] = { FIRST_GLYPH + g, 0 };
+        struct Glyph *glyph = &display->glyphs[g];
+        int minX = 0;
+        TTF_GlyphMetrics(display->font, text[0], &minX, 0, 0, 0, &glyph->advance);
+        glyph->offset = minX < 0 ? minX : 0;
+
+        surfaces[g] = TTF_RenderText_Blended(display->font, text, white);
+        if (!surfaces[g]) {
+            glyph->rect = (SDL_Rect) { 0, 0, 0, 0 };
+            continue;
+        }
+        glyph->rect = (SDL_Rect) { width, 0, surfaces[g]->w, surfaces[g]->h };
+        if (surfaces[g]->h > height) height = surfaces[g]->h;
+        width += surfaces[g]->w;
+    }
+
+    // Copy them into the atlas
+    SDL_Surface *atlas = SDL_CreateRGBSurfaceWithFormat(0, width > 0 ? width : 1, height, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!atlas) {
+        destroyDisplayAndExit(display, "Unable to create glyph atlas", SDL_GetError());
+    }
+    for (int g = 0; g < GLYPH_COUNT; g++) {
+        if (!surfaces[g]) continue;
+        SDL_SetSurfaceBlendMode(surfaces[g], SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(surfaces[g], NULL, atlas, &display->glyphs[g].rect);
+        SDL_FreeSurface(surfaces[g]);
+    }
+    display->glyphTexture = SDL_CreateTextureFromSurface(display->renderer, atlas);
+    SDL_FreeSurface(atlas);
+    if (!display->glyphTexture) {
+        destroyDisplayAndExit(display, "Unable to create glyph atlas", SDL_GetError());
+    }
+    SDL_SetTextureBlendMode(display->glyphTexture, SDL_BLENDMODE_BLEND);
+}
 void setColor(struct Display *display, Uint8 r, Uint8 g, Uint8 b) {
     display->color.r = r;
     display->color.g = g;
@@ -379,32 +815,27 @@ void setPosition(struct Display *display, int x, int y) {
     display->position.y = y;
 }
 void printText(struct Display *display, char *text) {
-    // Render text
-    SDL_Surface *textSurface = TTF_RenderText_Blended(
-        display->font,
-        text,
-        display->color
-    );
-    if (!textSurface) {
-        destroyDisplayAndExit(display, "Unable to render text.", TTF_GetError());
-    }
-    SDL_Texture *textTexture = SDL_CreateTextureFromSurface(display->renderer, textSurface);
-    if (!textTexture) {
-        destroyDisplayAndExit(display, "Unable create a text texture.", TTF_GetError());
+    SDL_Color c = display->color;
+    SDL_SetTextureColorMod(display->glyphTexture, c.r, c.g, c.b);
+
+    // Draw text to screen buffer, one glyph from the atlas at a time
+    int x = display->position.x;
+    char previous = 0;
+    for (char *t = text; *t; t++) {
+        if (*t < FIRST_GLYPH || *t > LAST_GLYPH) continue;
+        struct Glyph *glyph = &display->glyphs[*t - FIRST_GLYPH];
+        if (previous) x += TTF_GetFontKerningSizeGlyphs(display->font, previous, *t);
+
+        SDL_Rect dest = {
+            x + glyph->offset,
+            display->position.y,
+            glyph->rect.w,
+            glyph->rect.h
+        };
+        SDL_RenderCopy(display->renderer, display->glyphTexture, &glyph->rect, &dest);
+        x += glyph->advance;
+        previous = *t;
     }
-
-    // Draw rendered text to screen buffer
-    SDL_Rect dest = {
-        display->position.x,
-        display->position.y,
-        textSurface->w,
-        textSurface->h
-    };
-    SDL_RenderCopy(display->renderer, textTexture, 0, &dest);
-
-    // Clean up
-    SDL_DestroyTexture(textTexture);
-    SDL_FreeSurface(textSurface);
 }
 void drawLineAndSetPosition(struct Display *display, int x, int y) {
     SDL_RenderDrawLine(
@@ -426,28 +857,32 @@ void colorPixel(struct Display *display, int x, int y) {
 
 void displayFrame(struct Display *display, struct Frame *frame) {
 
-    // New Frame
-    setColor(display, 0, 0, 0);
-    SDL_RenderClear(display->renderer);
+    // New Frame, drawn into the screen texture for reuse by displayZoomRect
+    SDL_SetRenderTarget(display->renderer, display->screenTexture);
+    SDL_RenderCopy(display->renderer, display->chromeTexture, NULL, NULL);
     setColor(display, 255, 255, 255);
 
-    displayFrameBorder(display);
-
     // Display Empty Frame (if no frame data is provided)
-    if (!frame) {
-        return;
+    if (frame) {
+        displayFrameData(display, frame);
     }
 
-    displayFrameData(display, frame);
+    SDL_SetRenderTarget(display->renderer, NULL);
+    SDL_RenderCopy(display->renderer, display->screenTexture, NULL, NULL);
 }
+/*
+ * Draws the border, interval markers and axis labels,
+ * which are the same for every frame. This is only
+ * done once, into the chrome texture.
+ */
 void displayFrameBorder(struct Display *display) {
 
     // Draw Rectangle that will enclose the actual frame
 
-    const short xStart = FRAME_ORIGIN.x;
-    const short yStart = FRAME_ORIGIN.y;
-    const short xEnd = FRAME_WIDTH + FRAME_ORIGIN.x;
-    const short yEnd = FRAME_HEIGHT + FRAME_ORIGIN.y;
+    const int xStart = display->data.x - 1;
+    const int yStart = display->data.y - 1;
+    const int xEnd = display->data.x + display->data.w;
+    const int yEnd = display->data.y + display->data.h;
 
     // Note: Using line drawing instead of rect because
     //       experimenting with them both, the latter did
@@ -460,27 +895,35 @@ void displayFrameBorder(struct Display *display) {
     drawLineAndSetPosition(display, xEnd, yStart);
     drawLineAndSetPosition(display, xStart, yStart);
 
-    // Draw Interval Markers for grid
+    // Draw Interval Markers for grid, a tenth of the frame width apart
+    // starting from the origin
 
     const short markWidth = 6;
+    const double interval = (xEnd - xStart) / 10.0;
+    const int xMarks = (int) ((xEnd - xStart) / interval + 1e-9);
+    const int yMarks = (int) ((yEnd - yStart) / interval + 1e-9);
 
     // Draw Left interval markers
-    for (short y = FRAME_ORIGIN.y; y <= yEnd; y += 58) {
+    for (int m = 0; m <= yMarks; m++) {
+        int y = yEnd - (int) (m * interval + 0.5);
         setPosition(display, xStart - markWidth, y);
         drawLineAndSetPosition(display, xStart, y);
     }
     // Draw Bottom Side interval markers
-    for (short x = FRAME_ORIGIN.x; x <= xEnd; x += 58) {
+    for (int m = 0; m <= xMarks; m++) {
+        int x = xStart + (int) (m * interval + 0.5);
         setPosition(display, x, yEnd + 6);
         drawLineAndSetPosition(display, x, yEnd);
     }
     // Draw Right interval markers
-    for (short y = FRAME_ORIGIN.y; y <= yEnd; y += 58) {
+    for (int m = 0; m <= yMarks; m++) {
+        int y = yEnd - (int) (m * interval + 0.5);
         setPosition(display, xEnd + markWidth, y);
         drawLineAndSetPosition(display, xEnd, y);
     }
     // Draw Top Side interval markers
-    for (short x = FRAME_ORIGIN.x; x <= xEnd; x += 58) {
+    for (int m = 0; m <= xMarks; m++) {
+        int x = xStart + (int) (m * interval + 0.5);
         setPosition(display, x, yStart - 6);
         drawLineAndSetPosition(display, x, yStart);
     }
@@ -490,14 +933,14 @@ void displayFrameBorder(struct Display *display) {
     char label[256];
     
     // x-axis (real)
-    for (short x = 47, l = 0; x <= 627; x += 58, l++) {
-        setPosition(display, x, 429);
+    for (int l = 0; l <= xMarks; l++) {
+        setPosition(display, xStart - 3 + (int) (l * interval + 0.5), yEnd + 9);
         sprintf(label, "%i", l);
         printText(display, label);
     }
     // y-axis (imaginary)
-    for (short y = 414, l = 0; y >= 8; y -= 58, l++) {
-        setPosition(display, 35, y);
+    for (int l = 0; l <= yMarks; l++) {
+        setPosition(display, xStart - 15, yEnd - 6 - (int) (l * interval + 0.5));
         sprintf(label, "%i", l);
         printText(display, label);
     }
@@ -505,59 +948,365 @@ void displayFrameBorder(struct Display *display) {
 
 void displayFrameData(struct Display *display, struct Frame *frame) {
 
-    // Draw Origin and Interval Labels
+    // Draw Origin, Interval and Resolution Labels
+    displayFrameInfo(display, frame->x, frame->y, frame->w);
+    displayRenderInfo(display, frame->columns, frame->rows, frame->scale, frame->seconds);
+
+    // Render Frame, keeping its k values as an index image so that it
+    // can be colored in again when only the colors change
+    long entries = (long) frame->columns * frame->rows;
+    if (display->indexCapacity < entries) {
+        free(display->index);
+        display->index = malloc(entries * sizeof(unsigned short));
+        display->indexCapacity = display->index ? entries : 0;
+        if (!display->index) {
+            destroyDisplayAndExit(display, "Unable to allocate index image", "out of memory");
+        }
+    }
+    indexFrame(frame, display->index);
+    display->indexColumns = frame->columns;
+    display->indexRows = frame->rows;
+    display->indexMin = frame->min;
+    display->cached = frameView(frame);
+    colorFrameTexture(display);
+
+    // A frame rendered before the window was resized is stretched
+    SDL_RenderCopy(display->renderer, display->frameTexture, NULL, &display->data);
+}
+/*
+ * Color in the frame last shown by displayFrame again,
+ * after the colors changed but the frame did not, and
+ * show it without drawing anything else again.
+ */
+void displayFrameColors(struct Display *display) {
+    colorFrameTexture(display);
 
+    SDL_SetRenderTarget(display->renderer, display->screenTexture);
+    SDL_RenderCopy(display->renderer, display->frameTexture, NULL, &display->data);
+    SDL_SetRenderTarget(display->renderer, NULL);
+    SDL_RenderCopy(display->renderer, display->screenTexture, NULL, NULL);
+}
+void colorFrameTexture(struct Display *display) {
+
+    // Define color bands, only building the color table again
+    // when they change
+    buildColorTable(&display->table, useMin ? display->indexMin : 0, MAX_K, display->phase);
+
+    // Color in frame straight into the texture, keeping the result
+    // for later reuse
+    int columns = display->indexColumns;
+    int rows = display->indexRows;
+    void *pixels;
+    int pitch;
+    fitTexture(display, &display->frameTexture, columns, rows);
+    if (SDL_LockTexture(display->frameTexture, NULL, &pixels, &pitch) == 0) {
+        colorIndex(display->index, columns, rows, display->table.colors, pixels, pitch / sizeof(uint32_t));
+        SDL_UnlockTexture(display->frameTexture);
+    }
+    display->cachedTexture = display->frameTexture;
+}
+/*
+ * Show the screen as last drawn by displayFrame with
+ * the zoom rectangle over it. This costs a single
+ * copy however big the frame is, so it keeps up
+ * with dragging.
+ */
+void displayZoomRect(struct Display *display, const SDL_Rect *zoom) {
+    SDL_RenderCopy(display->renderer, display->screenTexture, NULL, NULL);
+    setColor(display, 255, 255, 255);
+    SDL_RenderDrawRect(display->renderer, zoom);
+    SDL_RenderPresent(display->renderer);
+    display->presentedAt = SDL_GetTicks();
+}
+void displayFrameInfo(struct Display *display, double x, double y, double w) {
     char label[256];
 
+    int bottom = display->data.y + display->data.h;
+
     // Origin
-    setPosition(display, 100, 447);
-    sprintf(label, "Origin:  X = %g  Y = %g", frame->x, frame->y);
+    setPosition(display, 100, bottom + 27);
+    sprintf(label, "Origin:  X = %g  Y = %g", x, y);
     printText(display, label);
 
     // Interval
-    setPosition(display, 100, 463);
-    sprintf(label, "Grid Interval:  %g", frame->w / 10);
+    setPosition(display, 100, bottom + 43);
+    sprintf(label, "Grid Interval:  %g", w / 10);
+    printText(display, label);
+}
+void displayRenderInfo(struct Display *display, int frameColumns, int frameRows, int scale, double seconds) {
+    char label[256];
+    char resolution[16] = "Full";
+    if (scale > 1) sprintf(resolution, "1/%i", scale);
+
+    // Resolution and the time it took to reach it (negative while rendering)
+    setPosition(display, 100, display->data.y + display->data.h + 59);
+    int columns = (frameColumns + scale - 1) / scale;
+    int rows = (frameRows + scale - 1) / scale;
+    if (seconds < 0) {
+        sprintf(label, "Resolution:  %s (%i x %i)  Rendering...", resolution, columns, rows);
+    } else {
+        sprintf(label, "Resolution:  %s (%i x %i)  Render Time:  %.0f ms", resolution, columns, rows, seconds * 1000);
+    }
     printText(display, label);
+}
 
-    // Render Frame
-    
-    // Define color bands
-    short min = useMin ? frame->min : 0;
-    short range = 1000 - min;
-    short div[15];
-    div[Brown]    = min + floor(range * .010); 
-    div[Violet]   = min + floor(range * .015);  
-    div[Red]      = min + floor(range * .020); 
-    div[RedHi]    = min + floor(range * .030); 
-    div[Orange]   = min + floor(range * .040); 
-    div[YellowLo] = min + floor(range * .050);
-    div[Yellow]   = min + floor(range * .060); 
-    div[GreenLo]  = min + floor(range * .080); 
-    div[Green]    = min + floor(range * .100); 
-    div[GreenHi]  = min + floor(range * .150); 
-    div[Cyan]     = min + floor(range * .200); 
-    div[BlueLo]   = min + floor(range * .250); 
-    div[Blue]     = min + floor(range * .300); 
-    div[BlueHi]   = min + floor(range * .350); 
-    div[Magenta]  = min + floor(range * .400); 
-
-    // Color in frame
-    for (short r = 0; r <= 578; r++) {
-        for (short i = 0; i <= 404; i++) {
-            short k = frame->k[r][i];
-            SDL_Color c = colors[Black];
-
-            // Determine b (color band)
-            for (short b = 0; b < Black; b++) {
-                if (k < div[b]) {
-                    c = colors[b];
-                    break;
-                }
-            }
+/*
+ * Zooming with the Mouse Wheel
+ *
+ * While the frame for a new viewport renders in the
+ * background, the last displayed frame data is scaled
+ * onto the new viewport and the rendered tiles are
+ * drawn over it as they complete.
+ */
+
+void displayZoom(struct Display *display, struct View view, struct Render *render) {
 
-            setColor(display, c.r, c.g, c.b);
-            colorPixel(display, r+51, i+15);
+    // New Frame
+    SDL_RenderCopy(display->renderer, display->chromeTexture, NULL, NULL);
+    setColor(display, 255, 255, 255);
+
+    displayFrameInfo(display, view.x, view.y, view.w);
+    if (render) displayRenderInfo(display, view.columns, view.rows, render->scale, -1);
+    displayZoomData(display, view, render, &display->data);
+}
+void displayZoomData(struct Display *display, struct View view, struct Render *render, const SDL_Rect *area) {
+
+    // Find where the cached frame data lands in the new viewport, in
+    // pixels of the area, which the viewport's points may not match
+    struct View cached = display->cached;
+    double gap = frameGap(view.w, view.columns);
+    double cachedGap = frameGap(cached.w, cached.columns);
+    double scaleX = (double) area->w / view.columns;
+    double scaleY = (double) area->h / view.rows;
+    double scale = cachedGap / gap;
+    SDL_FRect dest = {
+        area->x + (frameReal(cached.x, cachedGap, 0) - frameReal(view.x, gap, 0)) / gap * scaleX,
+        area->y + (frameImag(view.y, gap, view.rows, 0) - frameImag(cached.y, cachedGap, cached.rows, 0)) / gap * scaleY,
+        cached.columns * scale * scaleX,
+        cached.rows * scale * scaleY
+    };
+
+    SDL_RenderSetClipRect(display->renderer, area);
+    SDL_RenderCopyF(display->renderer, display->cachedTexture, NULL, &dest);
+    SDL_RenderSetClipRect(display->renderer, NULL);
+
+    // Cover it with the tiles that have been rendered
+    if (!render) return;
+    for (int s = 0; s < display->tilesShown; s++) {
+        struct Tile tile = frameTile(render->frame, atomic_load(&render->completed[s]));
+        SDL_Rect src = { tile.x, tile.y, tile.w, tile.h };
+        SDL_FRect dst = {
+            area->x + tile.x * scaleX,
+            area->y + tile.y * scaleY,
+            tile.w * scaleX,
+            tile.h * scaleY
+        };
+        SDL_RenderCopyF(display->renderer, display->liveTexture, &src, &dst);
+    }
+}
+
+/*
+ * Upload any newly completed tiles of a render and
+ * show them, at most once per PRESENT_INTERVAL.
+ */
+void displayRenderProgress(struct Display *display, struct View view, struct Render *render) {
+    if (uploadZoomTiles(display, render)) display->stale = 1;
+    if (display->stale && SDL_GetTicks() - display->presentedAt >= PRESENT_INTERVAL) {
+        displayZoom(display, view, render);
+        if (display->zoomRect.w > 0) {
+            setColor(display, 255, 255, 255);
+            SDL_RenderDrawRect(display->renderer, &display->zoomRect);
+        }
+        SDL_RenderPresent(display->renderer);
+        display->presentedAt = SDL_GetTicks();
+        display->stale = 0;
+    }
+}
+int uploadZoomTiles(struct Display *display, struct Render *render) {
+    struct Frame *frame = render->frame;
+    int uploaded = 0;
+    if (display->tilesShown == 0) fitTexture(display, &display->liveTexture, frame->columns, frame->rows);
+    while (display->tilesShown < render->tileCount) {
+        int t = atomic_load(&render->completed[display->tilesShown]);
+        if (t < 0) break;
+
+        // Tiles arrive already colored in by the workers
+        struct Tile tile = frameTile(frame, t);
+        SDL_Rect rect = { tile.x, tile.y, tile.w, tile.h };
+        uint32_t *pixels = render->pixels + (long) tile.y*frame->columns + tile.x;
+        SDL_UpdateTexture(display->liveTexture, &rect, pixels, frame->columns * sizeof(uint32_t));
+
+        display->tilesShown++;
+        uploaded++;
+    }
+    return uploaded;
+}
+void recolorZoomTiles(struct Display *display, struct Render *render) {
+    struct ColorTable table = { -1 };
+    buildColorTable(&table, useMin ? atomic_load(&render->min) : 0, render->frame->maxK, 0);
+    struct Frame *frame = render->frame;
+    for (int s = 0; s < display->tilesShown; s++) {
+        struct Tile tile = frameTile(frame, atomic_load(&render->completed[s]));
+        colorTile(frame, tile, table.colors, render->pixels, frame->columns);
+
+        SDL_Rect rect = { tile.x, tile.y, tile.w, tile.h };
+        uint32_t *pixels = render->pixels + (long) tile.y*frame->columns + tile.x;
+        SDL_UpdateTexture(display->liveTexture, &rect, pixels, frame->columns * sizeof(uint32_t));
+    }
+}
+/*
+ * Report how much a cooperative render cost beyond
+ * the rendering itself and the tiles loaded from and
+ * stored on disk, i.e. the overhead of splitting it
+ * into slices.
+ */
+void reportRender(struct Render *render) {
+    if (render->threadCount > 0 || render->busySeconds == 0) return;
+    double overhead = render->busySeconds - render->computeSeconds - render->cacheSeconds;
+    printf(
+        "Rendered in %i slices: %.1f ms rendering, %.1f ms loading and storing tiles, %.3f ms (%.2f%%) overhead\n",
+        render->slices,
+        render->computeSeconds * 1000,
+        render->cacheSeconds * 1000,
+        overhead * 1000,
+        overhead / render->busySeconds * 100
+    );
+}
+void rebaseZoom(struct Display *display, struct View view, struct Render *render) {
+
+    // Draw the zoom as it stands into a zoom texture that is not in use
+    SDL_Texture *texture = display->zoomTextures[0];
+    if (texture == display->cachedTexture) texture = display->zoomTextures[1];
+
+    SDL_Rect area = { 0, 0, display->data.w, display->data.h };
+    SDL_SetRenderTarget(display->renderer, texture);
+    setColor(display, 0, 0, 0);
+    SDL_RenderClear(display->renderer);
+    displayZoomData(display, view, render, &area);
+    SDL_SetRenderTarget(display->renderer, NULL);
+
+    // And make that the cached frame data
+    display->cachedTexture = texture;
+    display->cached = view;
+}
+
+/*
+ * Navigation
+ */
+
+struct View frameView(struct Frame *frame) {
+    return (struct View) { frame->x, frame->y, frame->w, frame->columns, frame->rows };
+}
+
+/*
+ * Go to a frame of the history tree. A frame that
+ * is still cached is shown right away. Otherwise it
+ * is rendered again, shown like a zoom from the
+ * current frame until it is done. Returns the
+ * render, if one was started.
+ */
+struct Render* goToFrame(struct Display *display, struct Frame **current, struct Frame *frame, struct Budget *budget, struct View *view) {
+    struct Render *render = NULL;
+    visitFrame(frame); // Unpacks its k values, if it is cached
+    if (frame->k) {
+        *current = frame;
+        displayFrame(display, frame);
+    } else {
+        render = reviveFrame(frame, chooseScale(budget, *current, frame->columns, frame->rows), useMin);
+        if (!render) {
+            printf("Unable to start render.\n");
+            displayFrame(display, *current);
+        } else {
+            *view = frameView(frame);
+            display->tilesShown = 0;
+            displayZoom(display, *view, render);
         }
     }
+    SDL_RenderPresent(display->renderer);
+    return render;
+}
+
+/*
+ * Checkpoints
+ */
+
+/*
+ * Keep the tiles of the start frame in a checkpoint
+ * file as it renders, carrying on from the tiles in
+ * it if it is of the same frame.
+ */
+void openStartCheckpoint(const char *path, double x, double y, double w, int columns, int rows) {
+    renderCheckpoint = openCheckpoint(path, x, y, w, columns, rows, MAX_K);
+    if (!renderCheckpoint) {
+        printf("Unable to use checkpoint %s, rendering without.\n", path);
+    } else if (atomic_load(&renderCheckpoint->saved) > 0) {
+        printf("Carrying on from %ld of %d tiles in %s\n", atomic_load(&renderCheckpoint->saved), renderCheckpoint->tileCount, path);
+    }
+}
+
+/*
+ * Exporting
+ */
+
+/*
+ * Render the start frame at the given size and write
+ * it to a file, without a window. Returns 0, or -1.
+ */
+int exportStartFrame(const char *path, double x, double y, double w, int columns, int rows, double slice) {
+    struct Render *render = startRender(NULL, x, y, w, columns, rows, 1, useMin);
+    if (!render) {
+        printf("Unable to start render.\n");
+        return -1;
+    }
+    while (!renderDone(render)) {
+        if (render->threadCount == 0) {
+            stepRender(render, slice);
+        } else {
+            SDL_Delay(4);
+        }
+    }
+    struct Frame *frame = finishRender(render);
+    struct Export *export = startExport(path, frame, columns, rows, useMin, 0);
+    int result = -1;
+    if (!export) {
+        printf("Unable to start export.\n");
+    } else {
+        result = reportExport(export);
+    }
+    freeFrame(frame);
+    return result;
 }
 
+/*
+ * Start exporting a frame in the background, at the
+ * given size (or its own, for 0) and color phase, to
+ * the first mandelbrot-<n>.png not yet taken.
+ */
+struct Export* exportFrame(struct Frame *frame, int columns, int rows, int phase) {
+    char path[32];
+    for (int n = 1; ; n++) {
+        snprintf(path, sizeof(path), "mandelbrot-%d.png", n);
+        FILE *fp = fopen(path, "rb");
+        if (!fp) break;
+        fclose(fp);
+    }
+    struct Export *export = startExport(
+        path, frame, columns ? columns : frame->columns, rows ? rows : frame->rows, useMin, phase
+    );
+    if (!export) printf("Unable to start export.\n");
+    return export;
+}
+
+/*
+ * Wait for an export to be written, say how it went,
+ * and free it. Returns 0 if it was written, or -1.
+ */
+int reportExport(struct Export *export) {
+    waitForExport(export);
+    if (export->result == 0) {
+        printf("Exported %s (%d x %d) in %.1f ms\n", export->path, export->columns, export->rows, export->seconds * 1000);
+    } else {
+        printf("Unable to export %s.\n", export->path);
+    }
+    return finishExport(export);
+}
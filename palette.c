@@ -0,0 +1,127 @@
+#include <math.h>
+
+#include "palette.h"
+
+const struct Color colors[] = {
+    [Brown] =    { 171,  87,   0, 255 },
+    [Violet] =   { 255,   0, 127, 255 },  
+    [Red] =      { 171,   0,   0, 255 },
+    [RedHi] =    { 255, 107,   0, 255 },
+    [Orange] =   { 255, 139,   0, 255 },
+    [YellowLo] = { 255, 171,   0, 255 },
+    [Yellow] =   { 255, 255,   0, 255 },
+    [GreenLo] =  { 127, 255,   0, 255 },
+    [Green] =    {   0, 171,   0, 255 },
+    [GreenHi] =  {   0, 255, 127, 255 },
+    [Cyan] =     {   0, 171, 171, 255 },
+    [BlueLo] =   {   0, 127, 255, 255 },
+    [Blue] =     {   0,   0, 171, 255 },
+    [BlueHi] =   { 127,   0, 255, 255 },
+    [Magenta] =  { 171,   0, 171, 255 },
+    [Black] =    {   0,   0,   0, 255 }
+};
+
+void defineColorBands(short min, short maxK, short *div) {
+    short range = maxK - min;
+    div[Brown]    = min + floor(range * .010); 
+    div[Violet]   = min + floor(range * .015);  
+    div[Red]      = min + floor(range * .020); 
+    div[RedHi]    = min + floor(range * .030); 
+    div[Orange]   = min + floor(range * .040); 
+    div[YellowLo] = min + floor(range * .050);
+    div[Yellow]   = min + floor(range * .060); 
+    div[GreenLo]  = min + floor(range * .080); 
+    div[Green]    = min + floor(range * .100); 
+    div[GreenHi]  = min + floor(range * .150); 
+    div[Cyan]     = min + floor(range * .200); 
+    div[BlueLo]   = min + floor(range * .250); 
+    div[Blue]     = min + floor(range * .300); 
+    div[BlueHi]   = min + floor(range * .350); 
+    div[Magenta]  = min + floor(range * .400); 
+}
+
+struct Color bandColor(short k, const short *div) {
+    // Determine b (color band)
+    for (short b = 0; b < Black; b++) {
+        if (k < div[b]) return colors[b];
+    }
+    return colors[Black];
+}
+
+/*
+ * A color as a pixel in the RGBA8888 format, that
+ * is 0xRRGGBBAA in the native byte order.
+ */
+uint32_t packColor(struct Color c) {
+    return (uint32_t) c.r << 24 | (uint32_t) c.g << 16 | (uint32_t) c.b << 8 | c.a;
+}
+
+/*
+ * Fill in a color table for the bands given by the
+ * minimum k value and the iteration cap (MAX_K, or a
+ * frame's own), unless it already has them.
+ * Coloring through the table saves going through
+ * the bands for each point.
+ *
+ * A non-zero phase shifts the colored bands along
+ * by that many k values, wrapping around, so that
+ * advancing it cycles the colors outwards.
+ */
+void buildColorTable(struct ColorTable *table, short min, short maxK, int phase) {
+    if (table->min == min && table->maxK == maxK && table->phase == phase) return;
+
+    short div[Black];
+    defineColorBands(min, maxK, div);
+    short span = div[Magenta] - min; // k values that are colored in
+    for (short k = 0; k < COLOR_TABLE_SIZE; k++) {
+        short band = k;
+        if (phase && span > 0 && k >= min && k < div[Magenta]) {
+            band = min + (k - min + span - phase % span) % span;
+        }
+        table->colors[k] = packColor(bandColor(band, div));
+    }
+    table->min = min;
+    table->maxK = maxK;
+    table->phase = phase;
+}
+
+/*
+ * Color in a tile of a frame through a color table,
+ * writing RGBA8888 pixels at the tile's position in
+ * an image of the sampled part of the frame with the
+ * given stride (pixels per row). The tile must lie
+ * within one of the frame's tiles.
+ */
+void colorTile(struct Frame *frame, struct Tile tile, const uint32_t *table, uint32_t *pixels, int stride) {
+    for (int i = tile.y; i < tile.y + tile.h; i++) {
+        const unsigned short *k = &FRAME_K(frame, tile.x, i);
+        uint32_t *row = pixels + (long) i*stride + tile.x;
+        for (int r = 0; r < tile.w; r++) {
+            row[r] = table[k[r]];
+        }
+    }
+}
+
+/*
+ * Lay out the k values of the sampled part of a
+ * frame as an index image, one row of the frame per
+ * row.
+ */
+void indexFrame(struct Frame *frame, unsigned short *index) {
+    copyFrameRows(frame, index, frame->columns);
+}
+
+/*
+ * Color in an index image of the given width and
+ * height through a color table, writing RGBA8888
+ * pixels with the given stride (pixels per row).
+ */
+void colorIndex(const unsigned short *index, int width, int height, const uint32_t *table, uint32_t *pixels, int stride) {
+    for (int i = 0; i < height; i++) {
+        const unsigned short *row = index + (long) i*width;
+        uint32_t *out = pixels + (long) i*stride;
+        for (int r = 0; r < width; r++) {
+            out[r] = table[row[r]];
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+
+#include "frame.h"
+
+/*
+ * Color Bands
+ *
+ * Points are colored by which band their k value
+ * falls in. The bands are fixed fractions of the
+ * range of k values from the minimum k value (or
+ * zero) up to the maximum. Points that never
+ * escaped are black.
+ */
+
+enum ColorBands {
+    Brown,
+    Violet,
+    Red,
+    RedHi,
+    Orange,
+    YellowLo,
+    Yellow,
+    GreenLo,
+    Green,
+    GreenHi,
+    Cyan,
+    BlueLo,
+    Blue,
+    BlueHi,
+    Magenta,
+    Black
+};
+
+// Same layout as SDL_Color.
+struct Color {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+};
+
+extern const struct Color colors[];
+
+// One entry per k value, up to MAX_K + 1 for points that never escaped
+// (or the lower cap a frame was rendered with, plus one).
+#define COLOR_TABLE_SIZE (MAX_K + 2)
+
+// RGBA8888 pixel for every k value, given the bands for a minimum k value.
+// The colored bands can be cycled by a phase, in k values.
+struct ColorTable {
+    short min; // Minimum k value the table was built for, -1 until built.
+    short maxK; // Iteration cap the table was built for.
+    int phase; // Phase the table was built for, 0 for the bands as they are.
+    uint32_t colors[COLOR_TABLE_SIZE];
+};
+
+void defineColorBands(short, short, short*);
+struct Color bandColor(short, const short*);
+uint32_t packColor(struct Color);
+void buildColorTable(struct ColorTable*, short, short, int);
+void colorTile(struct Frame*, struct Tile, const uint32_t*, uint32_t*, int);
+
+/*
+ * Index Images
+ *
+ * The k values of the sampled part of a frame laid
+ * out row by row, like the pixels of an image. The
+ * frame can be colored in again from it through a
+ * color table whenever the colors change, in one
+ * pass over memory and without the frame at hand.
+ */
+
+void indexFrame(struct Frame*, unsigned short*);
+void colorIndex(const unsigned short*, int, int, const uint32_t*, uint32_t*, int);
+
+#endif
@@ -0,0 +1,644 @@
+/*
+ * To build and run: `gcc -O2 poster.c frame.c palette.c kcodec.c tilecache.c checkpoint.c complex.c -lm -lpthread -o poster && ./poster x y w columns rows poster.tif`
+ * (must be done in the root project folder)
+ *
+ * Add -DSINGLE_THREADED to build without worker threads.
+ *
+ * Renders a frame too big to hold in memory (say 100,000 x 70,000
+ * points, for print) straight into a tiled BigTIFF, one tile at a time,
+ * along with overview levels each half the size of the one before, as
+ * image viewers expect of large images. Only a few tiles are in memory
+ * at once per thread, however big the poster.
+ *
+ * Progress is saved next to the poster as it goes (poster.tif.progress),
+ * so running the same command again after an interruption carries on
+ * from the last saved tile rather than starting over.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "palette.h"
+
+// Size of the tiles of the poster, in points (pixels).
+#define DEFAULT_TILE 512
+
+// Leaf tiles rendered between saving progress.
+#define CHECKPOINT_TILES 64
+
+// Most overview levels, down to a single tile.
+#define MAX_LEVELS 32
+
+#define PROGRESS_MAGIC "MPOSTER1"
+#define PROGRESS_HEADER 64
+
+/*
+ * Layout
+ *
+ * The poster is a BigTIFF of RGB tiles, stored
+ * uncompressed so that each tile has a fixed place
+ * in the file and can be written whenever it is
+ * ready, by whichever thread rendered it. Each level
+ * has its own directory (IFD), the full image first
+ * and then the overviews, each marked as a reduced
+ * resolution version of the one before.
+ *
+ *     header
+ *     for each level: IFD, tile offsets, tile byte counts
+ *     for each level: tiles, row by row
+ */
+
+#define IFD_ENTRIES 12
+#define IFD_BYTES (8 + IFD_ENTRIES * 20 + 8)
+
+struct Level {
+    int width;     // Pixels across this level.
+    int height;
+    int across;    // Tiles across this level.
+    int down;
+    long tiles;
+    long first;    // Index of its first tile among the tiles of all levels.
+    uint64_t ifd;  // Where its IFD starts in the file.
+    uint64_t data; // Where its tiles start.
+};
+
+struct Poster {
+    double x;      // Origin and width, as for a Frame.
+    double y;
+    double w;
+    int columns;
+    int rows;
+    int tileSize;
+    short min;     // Minimum k value the color bands are for.
+    int levelCount;
+    struct Level levels[MAX_LEVELS];
+    long tiles;    // Over all levels.
+    long tileBytes;
+    uint64_t fileSize;
+    struct ColorTable table;
+
+    int file;
+    int progress;            // The progress file, or -1.
+    atomic_uchar *written;   // Bit per tile, set once it is in the file.
+    atomic_uchar *children;  // Per tile, its children written so far.
+    long bitmapBytes;
+    atomic_long nextLeaf;    // Next position along the Z-order curve.
+    long curveLength;        // Positions along it.
+    atomic_long leavesDone;
+    atomic_long sinceCheckpoint;
+    atomic_int failed;
+#if !defined SINGLE_THREADED
+    pthread_mutex_t checkpointLock;
+#endif
+};
+
+// Working space for one thread.
+struct Scratch {
+    unsigned short *index; // k values of a tile, row by row.
+    uint8_t *pixels;       // An RGB tile.
+    uint8_t *child;        // An RGB tile of the level below.
+};
+
+static double seconds() {
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    return time.tv_sec + time.tv_usec * 1e-6;
+}
+
+static void putLE16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+static void putLE32(uint8_t *out, uint32_t value) {
+    putLE16(out, value);
+    putLE16(out + 2, value >> 16);
+}
+static void putLE64(uint8_t *out, uint64_t value) {
+    putLE32(out, value);
+    putLE32(out + 4, value >> 32);
+}
+
+/*
+ * Work out the levels, and where everything goes in
+ * the file.
+ */
+static void layOutPoster(struct Poster *poster) {
+    int width = poster->columns;
+    int height = poster->rows;
+    int size = poster->tileSize;
+    poster->tileBytes = (long) size * size * 3;
+    poster->levelCount = 0;
+    poster->tiles = 0;
+
+    uint64_t offset = 16;
+    for (int l = 0; l < MAX_LEVELS; l++) {
+        struct Level *level = &poster->levels[l];
+        level->width = width;
+        level->height = height;
+        level->across = (width + size - 1) / size;
+        level->down = (height + size - 1) / size;
+        level->tiles = (long) level->across * level->down;
+        level->first = poster->tiles;
+        level->ifd = offset;
+        offset += IFD_BYTES + level->tiles * 16;
+        poster->tiles += level->tiles;
+        poster->levelCount++;
+        if (level->tiles == 1) break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    offset = (offset + 4095) & ~(uint64_t) 4095;
+    for (int l = 0; l < poster->levelCount; l++) {
+        poster->levels[l].data = offset;
+        offset += poster->levels[l].tiles * poster->tileBytes;
+    }
+    poster->fileSize = offset;
+}
+
+static void putEntry(uint8_t *entry, uint16_t tag, uint16_t type, uint64_t count, uint64_t value) {
+    putLE16(entry, tag);
+    putLE16(entry + 2, type);
+    putLE64(entry + 4, count);
+    memset(entry + 12, 0, 8);
+    if (type == 3 && count == 1) putLE16(entry + 12, value);
+    else if (type == 4 && count == 1) putLE32(entry + 12, value);
+    else putLE64(entry + 12, value);
+}
+
+/*
+ * Write the header, and the directory and tile tables
+ * of every level. Returns 0, or -1.
+ */
+static int writeDirectories(struct Poster *poster) {
+    uint64_t size = poster->levels[poster->levelCount - 1].ifd + IFD_BYTES +
+                    poster->levels[poster->levelCount - 1].tiles * 16;
+    uint8_t *out = calloc(1, size);
+    if (!out) return -1;
+
+    memcpy(out, "II", 2);
+    putLE16(out + 2, 43); // BigTIFF
+    putLE16(out + 4, 8);  // Offset size
+    putLE64(out + 8, poster->levels[0].ifd);
+
+    for (int l = 0; l < poster->levelCount; l++) {
+        struct Level *level = &poster->levels[l];
+        uint8_t *ifd = out + level->ifd;
+        uint64_t offsets = level->ifd + IFD_BYTES;
+        uint64_t counts = offsets + level->tiles * 8;
+
+        putLE64(ifd, IFD_ENTRIES);
+        uint8_t *entry = ifd + 8;
+        putEntry(entry, 254, 4, 1, l > 0); entry += 20;              // NewSubfileType: reduced resolution
+        putEntry(entry, 256, 4, 1, level->width); entry += 20;       // ImageWidth
+        putEntry(entry, 257, 4, 1, level->height); entry += 20;      // ImageLength
+        putEntry(entry, 258, 3, 3, 0);                                // BitsPerSample, 8 each, inline
+        putLE16(entry + 12, 8);
+        putLE16(entry + 14, 8);
+        putLE16(entry + 16, 8);
+        entry += 20;
+        putEntry(entry, 259, 3, 1, 1); entry += 20;                  // Compression: none
+        putEntry(entry, 262, 3, 1, 2); entry += 20;                  // PhotometricInterpretation: RGB
+        putEntry(entry, 277, 3, 1, 3); entry += 20;                  // SamplesPerPixel
+        putEntry(entry, 284, 3, 1, 1); entry += 20;                  // PlanarConfiguration: chunky
+        putEntry(entry, 322, 4, 1, poster->tileSize); entry += 20;   // TileWidth
+        putEntry(entry, 323, 4, 1, poster->tileSize); entry += 20;   // TileLength
+        if (level->tiles == 1) {                                      // TileOffsets and TileByteCounts,
+            putEntry(entry, 324, 16, 1, level->data); entry += 20;   // inline if there is only one
+            putEntry(entry, 325, 16, 1, poster->tileBytes); entry += 20;
+        } else {
+            putEntry(entry, 324, 16, level->tiles, offsets); entry += 20;
+            putEntry(entry, 325, 16, level->tiles, counts); entry += 20;
+        }
+        putLE64(entry, l + 1 < poster->levelCount ? poster->levels[l + 1].ifd : 0);
+
+        for (long t = 0; t < level->tiles; t++) {
+            putLE64(out + offsets + t * 8, level->data + t * poster->tileBytes);
+            putLE64(out + counts + t * 8, poster->tileBytes);
+        }
+    }
+
+    int result = pwrite(poster->file, out, size, 0) == (ssize_t) size ? 0 : -1;
+    free(out);
+    return result;
+}
+
+/*
+ * Progress
+ *
+ * The progress file holds what the poster is of, and
+ * a bit per tile (of every level) that is safely in
+ * the poster file. The poster file is synced before
+ * the bits of the tiles written to it are, so a tile
+ * marked as written is there even after a crash.
+ */
+
+static void putProgressHeader(struct Poster *poster, uint8_t *header) {
+    memset(header, 0, PROGRESS_HEADER);
+    memcpy(header, PROGRESS_MAGIC, 8);
+    memcpy(header + 8, &poster->x, 8);
+    memcpy(header + 16, &poster->y, 8);
+    memcpy(header + 24, &poster->w, 8);
+    putLE32(header + 32, poster->columns);
+    putLE32(header + 36, poster->rows);
+    putLE32(header + 40, poster->tileSize);
+    putLE32(header + 44, poster->min);
+    putLE32(header + 48, MAX_K);
+}
+
+static int isWritten(struct Poster *poster, long tile) {
+    return atomic_load(&poster->written[tile / 8]) >> (tile % 8) & 1;
+}
+
+static void checkpoint(struct Poster *poster) {
+    if (poster->progress < 0) return;
+#if !defined SINGLE_THREADED
+    pthread_mutex_lock(&poster->checkpointLock);
+#endif
+    uint8_t *bits = malloc(poster->bitmapBytes);
+    if (bits) {
+        for (long b = 0; b < poster->bitmapBytes; b++) bits[b] = atomic_load(&poster->written[b]);
+        if (fdatasync(poster->file) != 0 ||
+            pwrite(poster->progress, bits, poster->bitmapBytes, PROGRESS_HEADER) != (ssize_t) poster->bitmapBytes ||
+            fdatasync(poster->progress) != 0) {
+            printf("Unable to save progress.\n");
+        }
+        free(bits);
+    }
+#if !defined SINGLE_THREADED
+    pthread_mutex_unlock(&poster->checkpointLock);
+#endif
+}
+
+/*
+ * Open the poster and its progress file, carrying on
+ * from where an earlier run of the same poster left
+ * off if there is one. Returns 0, or -1.
+ */
+static int openPoster(struct Poster *poster, const char *path) {
+    char progressPath[4096];
+    snprintf(progressPath, sizeof(progressPath), "%s.progress", path);
+    poster->bitmapBytes = (poster->tiles + 7) / 8;
+    poster->written = calloc(poster->bitmapBytes, 1);
+    poster->children = calloc(poster->tiles, 1);
+    if (!poster->written || !poster->children) return -1;
+
+    uint8_t expected[PROGRESS_HEADER];
+    uint8_t header[PROGRESS_HEADER];
+    putProgressHeader(poster, expected);
+
+    // Carry on?
+    poster->progress = open(progressPath, O_RDWR | O_CLOEXEC);
+    poster->file = poster->progress >= 0 ? open(path, O_RDWR | O_CLOEXEC) : -1;
+    struct stat status;
+    uint8_t *bits = malloc(poster->bitmapBytes);
+    if (poster->file >= 0 && bits && fstat(poster->file, &status) == 0 && (uint64_t) status.st_size == poster->fileSize &&
+        pread(poster->progress, header, PROGRESS_HEADER, 0) == PROGRESS_HEADER &&
+        memcmp(header, expected, PROGRESS_HEADER) == 0 &&
+        pread(poster->progress, bits, poster->bitmapBytes, PROGRESS_HEADER) == (ssize_t) poster->bitmapBytes) {
+        long done = 0;
+        for (long b = 0; b < poster->bitmapBytes; b++) {
+            atomic_store(&poster->written[b], bits[b]);
+            done += __builtin_popcount(bits[b]);
+        }
+        free(bits);
+        printf("Carrying on from %ld of %ld tiles.\n", done, poster->tiles);
+        return 0;
+    }
+    free(bits);
+    if (poster->file >= 0) close(poster->file);
+    if (poster->progress >= 0) close(poster->progress);
+
+    // Start over
+    poster->file = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (poster->file < 0) return -1;
+    if (ftruncate(poster->file, poster->fileSize) != 0 || writeDirectories(poster) != 0) return -1;
+    poster->progress = open(progressPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (poster->progress < 0 || pwrite(poster->progress, expected, PROGRESS_HEADER, 0) != PROGRESS_HEADER) {
+        printf("Unable to save progress to %s, carrying on without.\n", progressPath);
+        if (poster->progress >= 0) close(poster->progress);
+        poster->progress = -1;
+    }
+    checkpoint(poster);
+    return 0;
+}
+
+/*
+ * Tiles
+ */
+
+static uint64_t tileOffset(struct Poster *poster, int l, int tx, int ty) {
+    struct Level *level = &poster->levels[l];
+    return level->data + ((uint64_t) ty * level->across + tx) * poster->tileBytes;
+}
+
+static long tileIndex(struct Poster *poster, int l, int tx, int ty) {
+    return poster->levels[l].first + (long) ty * poster->levels[l].across + tx;
+}
+
+// Tiles of level l - 1 that make up a tile of level l.
+static int childCount(struct Poster *poster, int l, int tx, int ty) {
+    struct Level *below = &poster->levels[l - 1];
+    int across = 2*tx + 1 < below->across ? 2 : 1;
+    int down = 2*ty + 1 < below->down ? 2 : 1;
+    return across * down;
+}
+
+static void buildOverview(struct Poster*, int, int, int, struct Scratch*);
+
+/*
+ * Note that a tile is in the file, and build the
+ * overview tile above it once all of that tile's
+ * children are.
+ */
+static void tileWritten(struct Poster *poster, int l, int tx, int ty, struct Scratch *scratch) {
+    long tile = tileIndex(poster, l, tx, ty);
+    atomic_fetch_or(&poster->written[tile / 8], 1 << (tile % 8));
+    if (l + 1 == poster->levelCount) return;
+
+    long parent = tileIndex(poster, l + 1, tx / 2, ty / 2);
+    int children = atomic_fetch_add(&poster->children[parent], 1) + 1;
+    if (children == childCount(poster, l + 1, tx / 2, ty / 2)) buildOverview(poster, l + 1, tx / 2, ty / 2, scratch);
+}
+
+static int writeTile(struct Poster *poster, int l, int tx, int ty, const uint8_t *pixels) {
+    if (pwrite(poster->file, pixels, poster->tileBytes, tileOffset(poster, l, tx, ty)) != poster->tileBytes) {
+        atomic_store(&poster->failed, 1);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Render a tile of the full image, each point at its
+ * column and row of the whole poster, so that it is
+ * the same point a frame of the whole poster would
+ * sample there.
+ */
+static int renderLeaf(struct Poster *poster, int tx, int ty, struct Scratch *scratch) {
+    int size = poster->tileSize;
+    int column = tx * size;
+    int row = ty * size;
+    int columns = poster->columns - column < size ? poster->columns - column : size;
+    int rows = poster->rows - row < size ? poster->rows - row : size;
+    double gap = frameGap(poster->w, poster->columns);
+
+    for (int r = 0; r < columns; r++) {
+        double real = frameReal(poster->x, gap, column + r);
+        for (int i = 0; i < rows; i++) {
+            double imag = frameImag(poster->y, gap, poster->rows, row + i);
+            scratch->index[(long) i * columns + r] = pointK(real, imag, MAX_K);
+        }
+    }
+
+    memset(scratch->pixels, 0, poster->tileBytes);
+    for (int i = 0; i < rows; i++) {
+        const unsigned short *k = scratch->index + (long) i * columns;
+        uint8_t *out = scratch->pixels + (long) i * size * 3;
+        for (int r = 0; r < columns; r++, out += 3) {
+            uint32_t color = poster->table.colors[k[r]];
+            out[0] = color >> 24;
+            out[1] = color >> 16;
+            out[2] = color >> 8;
+        }
+    }
+    return writeTile(poster, 0, tx, ty, scratch->pixels);
+}
+
+/*
+ * Build a tile of an overview level from the (up to)
+ * four tiles below it, read back from the file, each
+ * pixel the average of the 2 x 2 pixels below.
+ */
+static void buildOverview(struct Poster *poster, int l, int tx, int ty, struct Scratch *scratch) {
+    int size = poster->tileSize;
+    int half = size / 2;
+    struct Level *below = &poster->levels[l - 1];
+    uint8_t *pixels = scratch->pixels;
+    memset(pixels, 0, poster->tileBytes);
+
+    for (int dy = 0; dy < 2; dy++) {
+        for (int dx = 0; dx < 2; dx++) {
+            int cx = 2*tx + dx;
+            int cy = 2*ty + dy;
+            if (cx >= below->across || cy >= below->down) continue;
+            if (pread(poster->file, scratch->child, poster->tileBytes, tileOffset(poster, l - 1, cx, cy)) != poster->tileBytes) {
+                atomic_store(&poster->failed, 1);
+                continue;
+            }
+
+            // Pixels of the child that are part of the image
+            int width = below->width - cx * size < size ? below->width - cx * size : size;
+            int height = below->height - cy * size < size ? below->height - cy * size : size;
+            for (int i = 0; i < (height + 1) / 2; i++) {
+                uint8_t *out = pixels + ((long) (dy * half + i) * size + dx * half) * 3;
+                for (int r = 0; r < (width + 1) / 2; r++, out += 3) {
+                    int sums[3] = { 0, 0, 0 };
+                    int count = 0;
+                    for (int y = 2*i; y < 2*i + 2 && y < height; y++) {
+                        for (int x = 2*r; x < 2*r + 2 && x < width; x++) {
+                            const uint8_t *in = scratch->child + ((long) y * size + x) * 3;
+                            sums[0] += in[0];
+                            sums[1] += in[1];
+                            sums[2] += in[2];
+                            count++;
+                        }
+                    }
+                    for (int c = 0; c < 3; c++) out[c] = (sums[c] + count / 2) / count;
+                }
+            }
+        }
+    }
+
+    if (writeTile(poster, l, tx, ty, pixels) == 0) tileWritten(poster, l, tx, ty, scratch);
+}
+
+/*
+ * Rendering
+ *
+ * Threads pick up tiles of the full image in Z-order
+ * (so that the four tiles under an overview tile are
+ * done close together, and it can be built while
+ * they are still cached), skipping any already in the
+ * file.
+ */
+
+// Undo the interleaving of the bits of a position along the Z-order curve.
+static int unshuffle(long position) {
+    int value = 0;
+    for (int b = 0; b < 31; b++) value |= (int) (position >> (2*b) & 1) << b;
+    return value;
+}
+
+static void* renderTiles(void *arg) {
+    struct Poster *poster = arg;
+    struct Scratch scratch;
+    scratch.index = malloc((long) poster->tileSize * poster->tileSize * sizeof(unsigned short));
+    scratch.pixels = malloc(poster->tileBytes);
+    scratch.child = malloc(poster->tileBytes);
+    if (!scratch.index || !scratch.pixels || !scratch.child) {
+        atomic_store(&poster->failed, 1);
+    }
+
+    long position;
+    while (!atomic_load(&poster->failed) && (position = atomic_fetch_add(&poster->nextLeaf, 1)) < poster->curveLength) {
+        int tx = unshuffle(position);
+        int ty = unshuffle(position >> 1);
+        if (tx >= poster->levels[0].across || ty >= poster->levels[0].down) continue;
+        if (isWritten(poster, tileIndex(poster, 0, tx, ty))) continue;
+
+        if (renderLeaf(poster, tx, ty, &scratch) != 0) break;
+        tileWritten(poster, 0, tx, ty, &scratch);
+
+        long done = atomic_fetch_add(&poster->leavesDone, 1) + 1;
+        if (atomic_fetch_add(&poster->sinceCheckpoint, 1) + 1 >= CHECKPOINT_TILES) {
+            atomic_store(&poster->sinceCheckpoint, 0);
+            checkpoint(poster);
+            printf("\r%ld of %ld tiles", done, poster->levels[0].tiles);
+            fflush(stdout);
+        }
+    }
+
+    free(scratch.index);
+    free(scratch.pixels);
+    free(scratch.child);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct Poster poster;
+    memset(&poster, 0, sizeof(poster));
+    poster.tileSize = DEFAULT_TILE;
+    int threads = defaultRenderThreads();
+    const char *path = NULL;
+    double numbers[5];
+    int count = 0;
+
+    // Read Options
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            threads = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--tile") == 0 && a + 1 < argc) {
+            poster.tileSize = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--min") == 0 && a + 1 < argc) {
+            poster.min = atoi(argv[++a]);
+        } else if (count < 5 && strncmp(argv[a], "--", 2) != 0) {
+            numbers[count++] = atof(argv[a]);
+        } else if (count == 5 && !path) {
+            path = argv[a];
+        } else {
+            count = 0;
+            break;
+        }
+    }
+    if (count < 5 || !path || numbers[2] <= 0 || numbers[3] < 1 || numbers[4] < 1 ||
+        poster.tileSize < 16 || poster.tileSize % 16 != 0 || poster.min < 0 || poster.min > MAX_K) {
+        printf("Usage: %s [--threads count] [--tile size] [--min k] x y w columns rows poster.tif\n", argv[0]);
+        printf("  x, y and w are the origin (bottom-left corner) and width, as in the viewer.\n");
+        printf("  --tile is the size of the tiles in pixels, a multiple of 16 (default %d).\n", DEFAULT_TILE);
+        printf("  --min is the k value the color bands start from (default 0).\n");
+        printf("Run again with the same arguments to carry on after an interruption.\n");
+        return 1;
+    }
+    poster.x = numbers[0];
+    poster.y = numbers[1];
+    poster.w = numbers[2];
+    poster.columns = numbers[3];
+    poster.rows = numbers[4];
+    poster.table.min = -1; // Not built yet, as zeroed it would pass for --min 0
+    buildColorTable(&poster.table, poster.min, MAX_K, 0);
+
+    layOutPoster(&poster);
+    if (openPoster(&poster, path) != 0) {
+        printf("Unable to write %s.\n", path);
+        return 1;
+    }
+    printf(
+        "%d x %d in %ld tiles of %d x %d, %d levels, %.1f GB\n", poster.columns, poster.rows, poster.levels[0].tiles,
+        poster.tileSize, poster.tileSize, poster.levelCount, poster.fileSize / 1e9
+    );
+
+    // Overview tiles whose children were written before an interruption, but not themselves
+    struct Scratch scratch = { NULL, malloc(poster.tileBytes), malloc(poster.tileBytes) };
+    if (!scratch.pixels || !scratch.child) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+    for (int l = 1; l < poster.levelCount; l++) {
+        struct Level *level = &poster.levels[l];
+        for (int ty = 0; ty < level->down; ty++) {
+            for (int tx = 0; tx < level->across; tx++) {
+                int written = 0;
+                for (int dy = 0; dy < 2; dy++) {
+                    for (int dx = 0; dx < 2; dx++) {
+                        if (2*tx + dx >= poster.levels[l - 1].across || 2*ty + dy >= poster.levels[l - 1].down) continue;
+                        written += isWritten(&poster, tileIndex(&poster, l - 1, 2*tx + dx, 2*ty + dy));
+                    }
+                }
+                atomic_store(&poster.children[tileIndex(&poster, l, tx, ty)], written);
+            }
+        }
+    }
+    for (int l = 1; l < poster.levelCount; l++) {
+        struct Level *level = &poster.levels[l];
+        for (int ty = 0; ty < level->down; ty++) {
+            for (int tx = 0; tx < level->across; tx++) {
+                long tile = tileIndex(&poster, l, tx, ty);
+                if (!isWritten(&poster, tile) && atomic_load(&poster.children[tile]) == childCount(&poster, l, tx, ty)) {
+                    buildOverview(&poster, l, tx, ty, &scratch);
+                }
+            }
+        }
+    }
+    free(scratch.pixels);
+    free(scratch.child);
+
+    // Render
+    int side = poster.levels[0].across > poster.levels[0].down ? poster.levels[0].across : poster.levels[0].down;
+    poster.curveLength = 1;
+    while (poster.curveLength < (long) side * side) poster.curveLength *= 4;
+    double start = seconds();
+#if !defined SINGLE_THREADED
+    pthread_mutex_init(&poster.checkpointLock, NULL);
+    pthread_t workers[MAX_THREADS];
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    int started = 0;
+    for (; started < threads - 1; started++) {
+        if (pthread_create(&workers[started], NULL, renderTiles, &poster) != 0) break;
+    }
+    renderTiles(&poster); // Lend a hand
+    for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+#else
+    (void) threads;
+    renderTiles(&poster);
+#endif
+    double elapsed = seconds() - start;
+
+    checkpoint(&poster);
+    int finished = !atomic_load(&poster.failed) && isWritten(&poster, poster.tiles - 1);
+    printf(
+        "\r%ld tiles rendered in %.1f s (%.2f megapixels/s)\n", atomic_load(&poster.leavesDone), elapsed,
+        atomic_load(&poster.leavesDone) * (double) poster.tileSize * poster.tileSize / elapsed / 1e6
+    );
+    if (!finished) {
+        printf("Unable to finish %s; run again to carry on.\n", path);
+        return 1;
+    }
+
+    // Done with the progress file
+    char progressPath[4096];
+    snprintf(progressPath, sizeof(progressPath), "%s.progress", path);
+    if (poster.progress >= 0) close(poster.progress);
+    unlink(progressPath);
+    close(poster.file);
+    free(poster.written);
+    free(poster.children);
+    return 0;
+}
@@ -10,8 +10,15 @@
  */
 
 /*
- * To build and run: `gcc sdl_port/color.c -lm -lSDL2 -lSDL2_ttf -o color && ./color`
+ * To build and run: `gcc sdl_port/color.c -lm -lpthread -lSDL2 -lSDL2_ttf -o color && ./color`
  * (must be done in the root project folder)
+ *
+ * Given a named pipe M is writing to (or - for standard input), the
+ * frame is colored in column by column as it is computed.
+ *
+ * A binary grid bigger than M's frame is browsed instead (see
+ * kpyramid.c): arrow keys or dragging pan, the wheel or +/- zoom,
+ * Home shows all of it, and escape quits.
  */
 
 #include <math.h>
@@ -23,9 +30,18 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include "sdl_helpers.c"
+#include "kgrid.c"
+#include "kpyramid.c"
+
+#if defined SDL_VERSION && defined KGRID_MAPPED
+#define BROWSE
+#endif
 
 #define RGB( rd, g, b) (0x3F3F3FL & ( (long) (b) << 16 | (g) << 8 | (rd) ) )
 
+/* entry of the band table for a k value, all k above 999 sharing one */
+#define BAND(k) ((k) < 0 ? 0 : (k) > 999 ? 1000 : (k))
+
 const int SCREEN_WIDTH = 700;
 const int SCREEN_HEIGHT = 500;
 
@@ -33,8 +49,20 @@ const int WIDTH = 580;
 const int HEIGHT = 406;
 
 int pix[580][406];          /* screen pixels */
-FILE *fopen();              /* file open function */
-FILE *fpin;                 /* input file pointer */
+int band[1001];             /* pixel value for each k value */
+#if defined SDL_VERSION
+Uint32 image[579 * 405];    /* colored in pixels, RGBA8888, row by row */
+#endif
+
+void assignBands(int);
+void makeTitles(char*, char*, double, double, double);
+#if defined SDL_VERSION
+void colorColumns(Uint32*, int, int);
+void showImage(SDL_Texture*, SDL_Texture*);
+#endif
+#if defined BROWSE
+void browse(struct KPyramid*, struct KGrid*, SDL_Texture*, SDL_Texture*, Uint32*);
+#endif
 
 int main(int argc, char *argv[])
 {
@@ -65,17 +93,12 @@ int main(int argc, char *argv[])
     int ans;                 /* miscellaneous user response */
     double BOT;              /* bottom dimension of the rectangular area
                                 of the complex plane to be examined */
-    int dif;                 /* k differential for assigning color */
-    int div[16];             /* divisions for assigning color */
     double fabs(double);     /* absolute value function */
     int i, j, k, n, m;       /* loop indices, array subscripts, or flags */
     int ii, jj, kk;          /* loop indices, array subscripts, or flags */
-    char IV[50];             /* interval between ticks on either axis */
     int len;                 /* string length */
     double limx, limy;       /* limit on size of rect. area of complex plane */
     int min;                 /* lowest k value */
-    char OX[15];             /* origin x-coordinate for labeling */
-    char OY[15];             /* origin y-coordinate for labeling */
     int paint[16];           /* sixteen screen colors used */
     int rd, g, b;            /* red, green, and blue for macro RGB */
     char resp[20];           /* miscellaneous user response */
@@ -87,6 +110,11 @@ int main(int argc, char *argv[])
                                 of the complex plane to be examined */
     char title1[100];        /* info under x-axis  */
     char title2[100];        /* info under x-axis  */
+    FILE *fpin = NULL;       /* input pipe, when streaming */
+    struct KGridReader *reader = NULL;  /* columns still to come from it */
+#if defined BROWSE
+    struct KPyramid *pyramid = NULL;    /* a grid too big to read in */
+#endif
 
     printf("\n\n\nMandelbrot set screen coloring program");
 
@@ -99,143 +127,54 @@ int main(int argc, char *argv[])
             || resp[0] == 'Q')))
            exit(0);
     }
-    if ((fpin = fopen(resp, "r")) == NULL) {
-        printf("\n\nError opening file %s ...\nProgram terminated ...\n",
-               resp);
-        exit(0);
-    }
 /*
- *    read input file
+ *    read input file, binary or text (see kgrid.c)
  */
     printf("\n%s","   reading input file...");
 
-    fscanf(fpin, "%lf %lf %lf %i", &swX, &swY, &BOT, &min);
-
-    for ( k = 0; k <= 36; k++) {
-        i = k * 16;                         /* 16 columns of data at a time */
-        for ( j = 0; j <= 404; j++) {       /* rows */
-            if (k == 36) {
-                fscanf(fpin,"%i %i %i\n",
-                       &pix[i][j], &pix[i+1][j], &pix[i+2][j]);
-            }
-            if (k < 36) {
-                fscanf(fpin,
-                "%i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i\n",
-                &pix[i][j], &pix[i+1][j], &pix[i+2][j], &pix[i+3][j],
-                &pix[i+4][j], &pix[i+5][j], &pix[i+6][j], &pix[i+7][j],
-                &pix[i+8][j], &pix[i+9][j], &pix[i+10][j], &pix[i+11][j],
-                &pix[i+12][j], &pix[i+13][j], &pix[i+14][j], &pix[i+15][j]);
-            }
-       }
-   }
+    struct KGrid grid;
+#if defined SDL_VERSION
+    if (isKGridStream(resp)) {              /* just the header for now */
+        fpin = strcmp(resp, "-") == 0 ? stdin : fopen(resp, "rb");
+        if (fpin == NULL || (reader = startKGridReader(fpin, &grid)) == NULL) {
+            printf("\n\nError reading file %s ...\nProgram terminated ...\n",
+                   resp);
+            exit(0);
+        }
+    }
+#endif
+    if (reader == NULL && readKGrid(resp, &grid, pix) != 0
+#if defined BROWSE
+        && (pyramid = openKPyramid(resp, &grid)) == NULL   /* any size */
+#endif
+        ) {
+        printf("\n\nError reading file %s ...\nProgram terminated ...\n",
+               resp);
+        exit(0);
+    }
+    swX = grid.swX;
+    swY = grid.swY;
+    BOT = grid.BOT;
+    min = reader ? 1000 : grid.min;         /* when streaming, lowest so far */
    printf("\n%s","   preparing to color screen...\n");
 /*
  *   prepare graph labels
  */
     SID = BOT * HEIGHT/WIDTH;
-    sprintf (IV, "%22.20f", (BOT/10));
-    sprintf(OX, "%12.9f", swX);
-    sprintf(OY, "%12.9f", swY);
-    strcpy(title1,"ORIGIN:   X = ");
-    strcat(title1,OX);
-    strcat(title1,"     Y = ");
-    strcat(title1,OY);
-    strcpy(title2,"grid interval = ");
-    strcat(title2,IV);
+    makeTitles(title1, title2, swX, swY, BOT/10);
 
 /*****************************
  *  assign colors to pixels:
  ****************************/
-    dif = 1000 - min;
-    div[0] =  min + (int)floor( (float)dif * .010);    /*  white     */
-    div[1] =  min + (int)floor( (float)dif * .015);    /*  brown     */
-    div[2] =  min + (int)floor( (float)dif * .020);    /*  red       */
-    div[3] =  min + (int)floor( (float)dif * .030);    /*  redhi     */
-    div[4] =  min + (int)floor( (float)dif * .040);    /*  orange    */
-    div[5] =  min + (int)floor( (float)dif * .050);    /*  yellowlo  */
-    div[6] =  min + (int)floor( (float)dif * .060);    /*  yellow    */
-    div[7] =  min + (int)floor( (float)dif * .080);    /*  greenlo   */
-    div[8] =  min + (int)floor( (float)dif * .100);    /*  green     */
-    div[9] =  min + (int)floor( (float)dif * .150);    /*  greenhi   */
-    div[10] =  min + (int)floor( (float)dif * .200);   /*  cyan      */
-    div[11] =  min + (int)floor( (float)dif * .250);   /*  bluelo    */
-    div[12] =  min + (int)floor( (float)dif * .300);   /*  blue      */
-    div[13] =  min + (int)floor( (float)dif * .350);   /*  bluehi    */
-    div[14] =  min + (int)floor( (float)dif * .400);   /*  magenta   */
+    assignBands(min);
 
+#if defined _VRES16COLOR
     for ( i = 0; i <= 578; i++) {
         for ( j = 0; j <= 404; j++) {
-            k = 0;
-            if (pix[i][j] > 999) {
-                pix[i][j] = 0;                      /* BLACK pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[0] && k == 0) {
-                pix[i][j] = 16;                     /* WHITE pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[1] && k == 0) {
-                pix[i][j] = 15;                     /* BROWN pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[2] && k == 0) {
-                pix[i][j] = 14;                     /* RED pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[3] && k == 0) {
-                pix[i][j] = 13;                     /* REDHI pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[4] && k == 0) {
-                pix[i][j] = 12;                     /* ORANGE pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[5] && k == 0) {
-                pix[i][j] = 11;                     /* YELLOWLO pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[6] && k == 0) {
-                pix[i][j] = 10;                     /* YELLOW pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[7] && k == 0) {
-                pix[i][j] = 9;                     /* GREENLO pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[8] && k == 0) {
-                pix[i][j] = 8;                     /* GREEN pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[9] && k == 0) {
-                pix[i][j] = 7;                     /* GREENHI pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[10] && k == 0) {
-                pix[i][j] = 6;                     /* CYAN pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[11] && k == 0) {
-                pix[i][j] = 5;                     /* BLUELO pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[12] && k == 0) {
-                pix[i][j] = 4;                     /* BLUE pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[13] && k == 0) {
-                pix[i][j] = 3;                     /* BLUEHI pixels */
-                k = 1;
-            }
-            if (pix[i][j] < div[14] && k == 0) {
-                pix[i][j] = 2;                     /* MAGENTA pixels */
-                k = 1;
-            }
-            if (pix[i][j] < 1000 && k == 0) {
-                pix[i][j] = 1;                     /* VIOLET pixels */
-                k = 1;
-            }
+            pix[i][j] = band[BAND(pix[i][j])];
         }
     }
+#endif
 
 /******************************************
  *  draw graph lines and labels:
@@ -324,6 +263,15 @@ int main(int argc, char *argv[])
 #elif defined SDL_VERSION
     setupGraphics("Mandelbrot", SCREEN_WIDTH, SCREEN_HEIGHT);
 
+    /* drawn once, under the image every time it is shown */
+    SDL_Texture *graph = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                           SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (!graph) {
+        cleanupAndExit("Unable to create graph texture.", SDL_GetError());
+    }
+    SDL_SetRenderTarget(renderer, graph);
+    newFrame();
+
     setPalletColor(3);
     setPosition(50,8);                  /* 6 pixels north of the northwest corner  */
     drawLineAndSetPosition(50,420);     /* southwest corner (drawing left side)    */
@@ -495,10 +443,17 @@ int main(int argc, char *argv[])
     setPosition(627,429);
     printText("10");
 
+#if defined BROWSE
+    if (pyramid == NULL) {     /* otherwise of the view, drawn over it */
+#endif
     setPosition(100,447);      /* info under the x-axis */
     printText(title1);
     setPosition(100,463);
     printText(title2);
+#if defined BROWSE
+    }
+#endif
+    SDL_SetRenderTarget(renderer, NULL);
 #endif
 
 /**********************
@@ -569,30 +524,274 @@ int main(int argc, char *argv[])
     paint[14] = 8;    /* violet   */
     paint[15] = 6;    /* brown    */
 
-    for ( m = 0; m <= 15; m++) {
 #if defined _VRES16COLOR
+    for ( m = 0; m <= 15; m++) {
         _setcolor(paint[m]);
-#elif defined SDL_VERSION
-        setPalletColor(paint[m]);
-#endif
         for ( i = 0; i <= 578; i++) {
             for ( j = 0; j <= 404; j++) {
-#if defined _VRES16COLOR
                 if (pix[i][j] == (m+1) ) _setpixel(i+51,j+15);
+            }
+        }
+    }
 #elif defined SDL_VERSION
-                if (pix[i][j] == (m+1)) colorPixel(i+51,j+15);
+    {
+        Uint32 rgba[17];            /* RGBA8888 for each pixel value */
+        Uint32 lut[1001];           /* RGBA8888 for each k value */
+        SDL_Color p;
+        SDL_Texture *texture;
+        Uint32 shown;               /* when the image was last shown */
+
+        rgba[0] = 0x000000FF;                                 /* BLACK */
+        for ( m = 0; m <= 15; m++) {
+            p = pallet[paint[m]];
+            rgba[m+1] = (Uint32) p.r << 24 | (Uint32) p.g << 16 | (Uint32) p.b << 8 | 0xFF;
+        }
+        for ( kk = 0; kk <= 1000; kk++) lut[kk] = rgba[band[kk]];
+
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                    SDL_TEXTUREACCESS_STATIC, 579, 405);
+        if (!texture) {
+            cleanupAndExit("Unable to create frame texture.", SDL_GetError());
+        }
+
+#if defined BROWSE
+        if (pyramid != NULL) {
+            /* pan and zoom around it until closed */
+            browse(pyramid, &grid, graph, texture, lut);
+            closeKPyramid(pyramid);
+        } else
 #endif
+        if (reader == NULL) {
+            /* classify and color in every pixel in one pass */
+            colorColumns(lut, 0, 579);
+        } else {
+            /* color in each column as it comes down the pipe, going back
+               over those before whenever a lower k value moves the bands */
+            shown = SDL_GetTicks();
+            for ( i = 0; i <= 578 && readKGridColumn(reader, pix[i]) == 0; i++) {
+                for ( j = 0, k = min; j <= 404; j++) {
+                    if (pix[i][j] < k) k = pix[i][j];
+                }
+                if (k < min) {
+                    min = k;
+                    assignBands(min);
+                    for ( kk = 0; kk <= 1000; kk++) lut[kk] = rgba[band[kk]];
+                    colorColumns(lut, 0, i + 1);
+                } else {
+                    colorColumns(lut, i, i + 1);
+                }
+                if (SDL_GetTicks() - shown >= 40) {
+                    SDL_PumpEvents();
+                    showImage(graph, texture);
+                    shown = SDL_GetTicks();
+                }
+            }
+            if (finishKGridReader(reader, &grid) != 0) {
+                printf("\n\nFile %s ended early ...\n", resp);
             }
+            if (fpin != stdin) fclose(fpin);
         }
+
+        /* and put them on the screen in one upload */
+#if defined BROWSE
+        if (pyramid == NULL)
+#endif
+        showImage(graph, texture);
+        SDL_DestroyTexture(texture);
     }
+#endif
 
 #if defined _VRES16COLOR
     getch();                        /* pause */
     _setvideomode(_DEFAULTMODE);
 #elif defined SDL_VERSION
-    SDL_RenderPresent(renderer);
+#if defined BROWSE
+    if (pyramid == NULL)
+#endif
     waitForExit();
+    SDL_DestroyTexture(graph);
     cleanupGraphics();
 #endif
 }
 
+/*
+ *   work out the pixel value for every k value, from the divisions
+ *   for the lowest k value: the divisions are the same for every
+ *   pixel, so each pixel is then just looked up
+ */
+void assignBands(int min) {
+    int dif;                 /* k differential for assigning color */
+    int div[16];             /* divisions for assigning color */
+    int n, kk;
+
+    dif = 1000 - min;
+    div[0] =  min + (int)floor( (float)dif * .010);    /*  white     */
+    div[1] =  min + (int)floor( (float)dif * .015);    /*  brown     */
+    div[2] =  min + (int)floor( (float)dif * .020);    /*  red       */
+    div[3] =  min + (int)floor( (float)dif * .030);    /*  redhi     */
+    div[4] =  min + (int)floor( (float)dif * .040);    /*  orange    */
+    div[5] =  min + (int)floor( (float)dif * .050);    /*  yellowlo  */
+    div[6] =  min + (int)floor( (float)dif * .060);    /*  yellow    */
+    div[7] =  min + (int)floor( (float)dif * .080);    /*  greenlo   */
+    div[8] =  min + (int)floor( (float)dif * .100);    /*  green     */
+    div[9] =  min + (int)floor( (float)dif * .150);    /*  greenhi   */
+    div[10] =  min + (int)floor( (float)dif * .200);   /*  cyan      */
+    div[11] =  min + (int)floor( (float)dif * .250);   /*  bluelo    */
+    div[12] =  min + (int)floor( (float)dif * .300);   /*  blue      */
+    div[13] =  min + (int)floor( (float)dif * .350);   /*  bluehi    */
+    div[14] =  min + (int)floor( (float)dif * .400);   /*  magenta   */
+
+/*
+ *   k > 999 is BLACK (0), k < div[0] is WHITE (16), and so on down
+ *   to k < 1000 being VIOLET (1)
+ */
+    for ( kk = 0; kk <= 1000; kk++) {
+        for ( n = 0; n <= 14 && kk >= div[n]; n++)
+            ;
+        band[kk] = kk > 999 ? 0 : 16 - n;
+    }
+}
+
+/*
+ *   the info under the x-axis, for a view from the southwest corner
+ *   swX, swY with ticks interval apart
+ */
+void makeTitles(char *title1, char *title2, double swX, double swY, double interval) {
+    char IV[50];             /* interval between ticks on either axis */
+    char OX[15];             /* origin x-coordinate for labeling */
+    char OY[15];             /* origin y-coordinate for labeling */
+
+    sprintf (IV, "%22.20f", interval);
+    sprintf(OX, "%12.9f", swX);
+    sprintf(OY, "%12.9f", swY);
+    strcpy(title1,"ORIGIN:   X = ");
+    strcat(title1,OX);
+    strcat(title1,"     Y = ");
+    strcat(title1,OY);
+    strcpy(title2,"grid interval = ");
+    strcat(title2,IV);
+}
+
+#if defined SDL_VERSION
+/*
+ *   color in columns from up to to of the image
+ */
+void colorColumns(Uint32 *lut, int from, int to) {
+    for (int i = from; i < to; i++) {
+        for (int j = 0; j <= 404; j++) {
+            image[j*579 + i] = lut[BAND(pix[i][j])];
+        }
+    }
+}
+
+/*
+ *   show the image over the graph
+ */
+void showImage(SDL_Texture *graph, SDL_Texture *texture) {
+    SDL_Rect dest = { 51, 15, 579, 405 };
+    SDL_RenderCopy(renderer, graph, NULL, NULL);
+    SDL_UpdateTexture(texture, NULL, image, 579 * sizeof(Uint32));
+    SDL_RenderCopy(renderer, texture, NULL, &dest);
+    SDL_RenderPresent(renderer);
+}
+#endif
+
+#if defined BROWSE
+/*
+ *   pan and zoom around a grid too big to read in, drawing only the
+ *   part on the screen (see kpyramid.c); the view is kept as the column
+ *   and row of the grid at its top left, and the columns of the grid
+ *   per pixel
+ */
+void browse(struct KPyramid *pyramid, struct KGrid *grid, SDL_Texture *graph,
+            SDL_Texture *texture, Uint32 *lut) {
+    SDL_Rect dest = { 51, 15, 579, 405 };
+    SDL_Event e;
+    char title1[100];        /* info under x-axis, for the view */
+    char title2[100];
+    double gap = grid->BOT / pyramid->columns;   /* grid interval of the grid */
+    double fit = fmax((double) pyramid->columns / 579, (double) pyramid->rows / 405);
+    double scale = fit;
+    double left = (pyramid->columns - 579 * scale) / 2;
+    double top = (pyramid->rows - 405 * scale) / 2;
+    double zoom, x, y;
+    int mx, my, changed = 1;
+
+    for (;;) {
+        if (changed) {
+            drawKPyramid(pyramid, left, top, scale, lut, image, 579, 405);
+            makeTitles(title1, title2, grid->swX + left * gap,
+                       grid->swY + (pyramid->rows - (top + 405 * scale)) * gap, 579 * scale * gap / 10);
+            SDL_RenderCopy(renderer, graph, NULL, NULL);
+            SDL_UpdateTexture(texture, NULL, image, 579 * sizeof(Uint32));
+            SDL_RenderCopy(renderer, texture, NULL, &dest);
+            setPosition(100,447);
+            printText(title1);
+            setPosition(100,463);
+            printText(title2);
+            SDL_RenderPresent(renderer);
+            changed = 0;
+        }
+
+        /* take every event waiting before drawing again */
+        if (!SDL_WaitEvent(&e)) continue;
+        do {
+            zoom = 1;
+            SDL_GetMouseState(&mx, &my);
+            x = mx - dest.x;
+            y = my - dest.y;
+            if (x < 0 || x >= 579 || y < 0 || y >= 405) {
+                x = 579 / 2.0;   /* zoom about the middle unless over the image */
+                y = 405 / 2.0;
+            }
+            switch (e.type) {
+            case SDL_QUIT:
+                return;
+            case SDL_KEYDOWN:
+                switch (e.key.keysym.sym) {
+                case SDLK_ESCAPE: return;
+                case SDLK_LEFT:   left -= 579 * scale / 4; break;
+                case SDLK_RIGHT:  left += 579 * scale / 4; break;
+                case SDLK_UP:     top -= 405 * scale / 4; break;
+                case SDLK_DOWN:   top += 405 * scale / 4; break;
+                case SDLK_PLUS: case SDLK_EQUALS: case SDLK_KP_PLUS:
+                    zoom = 2; x = 579 / 2.0; y = 405 / 2.0; break;
+                case SDLK_MINUS: case SDLK_KP_MINUS:
+                    zoom = 0.5; x = 579 / 2.0; y = 405 / 2.0; break;
+                case SDLK_HOME:
+                    scale = fit;
+                    left = (pyramid->columns - 579 * scale) / 2;
+                    top = (pyramid->rows - 405 * scale) / 2;
+                    break;
+                default: continue;
+                }
+                break;
+            case SDL_MOUSEWHEEL:
+                zoom = pow(1.25, e.wheel.y);
+                break;
+            case SDL_MOUSEMOTION:
+                if (!(e.motion.state & SDL_BUTTON_LMASK)) continue;
+                left -= e.motion.xrel * scale;
+                top -= e.motion.yrel * scale;
+                break;
+            case SDL_WINDOWEVENT:
+                break;
+            default:
+                continue;
+            }
+
+            /* zoom about (x, y), from 16 pixels per k value out to twice the whole grid */
+            if (zoom != 1) {
+                double to = fmin(fmax(scale / zoom, 1.0 / 16), 2 * fit);
+                left += x * (scale - to);
+                top += y * (scale - to);
+                scale = to;
+            }
+            /* and keep some of the grid in view */
+            left = fmin(fmax(left, -579 * scale / 2), pyramid->columns - 579 * scale / 2);
+            top = fmin(fmax(top, -405 * scale / 2), pyramid->rows - 405 * scale / 2);
+            changed = 1;
+        } while (SDL_PollEvent(&e));
+    }
+}
+#endif
@@ -0,0 +1,72 @@
+/*
+ * K Grid Converter
+ *
+ * Converts frames written by M between the text and
+ * binary k grid formats (see kgrid.c), so that old
+ * text files can be brought over, and binary files
+ * looked at or handed to tools that expect text.
+ */
+
+/*
+ * To build and run: `gcc sdl_port/kconvert.c -lpthread -o kconvert && ./kconvert input output`
+ * (must be done in the root project folder)
+ *
+ * The output is in whichever format the input is not,
+ * unless --text or --binary is given. A binary input
+ * can also be a pipe, or - for standard input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kgrid.c"
+
+int pix[580][406];          /* k values */
+
+int main(int argc, char *argv[])
+{
+    const char *input = NULL;
+    const char *output = NULL;
+    int binary = -1;         /* format to write, -1 for the other one */
+
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--text") == 0) {
+            binary = 0;
+        } else if (strcmp(argv[a], "--binary") == 0) {
+            binary = 1;
+        } else if (!input) {
+            input = argv[a];
+        } else if (!output) {
+            output = argv[a];
+        } else {
+            input = NULL;
+            break;
+        }
+    }
+    if (!input || !output) {
+        printf("Usage: %s [--text | --binary] input output\n", argv[0]);
+        return 1;
+    }
+
+    struct KGrid grid;
+    if (readKGrid(input, &grid, pix) != 0) {
+        printf("Error reading file %s\n", input);
+        return 1;
+    }
+    if (binary < 0) binary = !grid.binary;
+
+    FILE *fp = fopen(output, binary ? "wb" : "w");
+    if (fp == NULL) {
+        printf("Error opening file %s\n", output);
+        return 1;
+    }
+    int result = binary ? writeKGrid(fp, &grid, pix) : writeTextKGrid(fp, &grid, pix);
+    if (fclose(fp) != 0) result = -1;
+    if (result != 0) {
+        printf("Error writing file %s\n", output);
+        return 1;
+    }
+    printf("%s: %s -> %s\n", output, grid.binary ? "binary" : "text", binary ? "binary" : "text");
+    return 0;
+}
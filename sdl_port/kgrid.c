@@ -0,0 +1,794 @@
+/*
+ * K Grid Files
+ *
+ * Frames written by M and read by COLOR. Originally
+ * these were text: the origin, width and lowest k
+ * value, then the k values as `%4i` fields in strips
+ * of 16 columns. That is about 5 bytes per value and
+ * some 235,000 fscanf conversions to read back.
+ *
+ * Frames are now written in a binary format instead:
+ * a 64 byte header, then the k values as unsigned
+ * 16 bit (or 32 bit) little-endian integers, column
+ * by column, the same order as pix. The file can be
+ * mapped and its values used as they are.
+ *
+ *     offset  size  field
+ *          0     8  magic, "MANDKGRD"
+ *          8     4  version, 1
+ *         12     4  columns
+ *         16     4  rows
+ *         20     4  iteration cap (k values above it never escaped)
+ *         24     4  lowest k value, signed
+ *         28     4  bytes per k value, 2 or 4
+ *         32     8  x-coordinate of the southwest corner, IEEE double
+ *         40     8  y-coordinate of the southwest corner, IEEE double
+ *         48     8  bottom dimension (width), IEEE double
+ *         56     4  offset of the k values, 64
+ *         60     4  flags: 1 if the lowest k value is not in the
+ *                   header (0 there) but follows the k values
+ *
+ * Text files are still read, and kconvert.c converts
+ * between the two. M streams its grid out column by
+ * column as they are computed (see startKGrid), and
+ * when writing to a pipe, COLOR can paint the columns
+ * as they come in (see startKGridReader). Where files can be mapped, text
+ * is parsed straight from the mapping rather than
+ * through fscanf, with the 37 strips split between
+ * threads (unless built with -DSINGLE_THREADED).
+ * Binary grids of any other size can't be read into
+ * pix, but COLOR browses them mapped (see kpyramid.c).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined __unix__ || defined __APPLE__
+#define KGRID_MAPPED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if !defined SINGLE_THREADED
+#define KGRID_THREADED
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+#endif
+
+#define KGRID_MAGIC "MANDKGRD"
+#define KGRID_VERSION 1
+#define KGRID_HEADER 64
+#define KGRID_MIN_AT_END 1   /* flag: the lowest k value follows the k values */
+
+/* grid written by M: pix is [580][406], of which 579 x 405 are computed */
+#define KGRID_COLUMNS 579
+#define KGRID_ROWS 405
+#define KGRID_STRIDE 406
+#define KGRID_MAX_K 1000
+
+/* text files: strips of 16 columns, the last one of 3 */
+#define KGRID_STRIP 16
+#define KGRID_STRIPS 37
+
+/* most threads to parse text with */
+#define KGRID_THREADS 8
+
+/* columns gathered before being handed off to be written, to a file or a pipe */
+#define KGRID_BUFFER_COLUMNS 64
+#define KGRID_STREAM_COLUMNS 4
+
+struct KGrid {
+    double swX;     /* southwest corner and bottom dimension */
+    double swY;
+    double BOT;
+    int min;        /* lowest k value */
+    int binary;     /* whether it was read from a binary file */
+};
+
+/* a binary k grid being written a column at a time */
+struct KGridWriter {
+    FILE *fp;
+    long start;               /* where the header is */
+    uint8_t *buffers[2];      /* one being filled, the other being written */
+    int filling;
+    size_t used;              /* bytes in the one being filled */
+    int columns;              /* columns so far */
+    int batch;                /* columns per buffer */
+    int streaming;            /* whether fp is a pipe, and can't be gone back over */
+    int failed;
+#if defined KGRID_THREADED
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    const uint8_t *writing;   /* handed off to the thread, */
+    size_t pending;           /* this many bytes of it, 0 once written */
+    int finished;             /* whether there are no more to come */
+#endif
+};
+
+/* a binary k grid being read a column at a time */
+struct KGridReader {
+    FILE *fp;
+    uint32_t valueSize;
+    uint32_t flags;
+    int columns;              /* columns so far */
+};
+
+int isBinaryKGrid(const char*);
+int readKGrid(const char*, struct KGrid*, int[][KGRID_STRIDE]);
+int writeKGrid(FILE*, const struct KGrid*, int[][KGRID_STRIDE]);
+int readTextKGrid(FILE*, struct KGrid*, int[][KGRID_STRIDE]);
+int writeTextKGrid(FILE*, const struct KGrid*, int[][KGRID_STRIDE]);
+struct KGridWriter* startKGrid(FILE*, const struct KGrid*);
+int writeKGridColumn(struct KGridWriter*, const int*);
+int finishKGrid(struct KGridWriter*, int);
+int isKGridStream(const char*);
+struct KGridReader* startKGridReader(FILE*, struct KGrid*);
+int readKGridColumn(struct KGridReader*, int*);
+int finishKGridReader(struct KGridReader*, struct KGrid*);
+static int getKGridFields(const uint8_t*, struct KGrid*, uint32_t*, uint32_t*, uint32_t*);
+#if defined KGRID_MAPPED
+static int parseTextKGrid(const char*, size_t, struct KGrid*, int[][KGRID_STRIDE]);
+#endif
+
+/*
+ * Little-endian fields
+ */
+
+static uint32_t getLE32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+static double getLEDouble(const uint8_t *p) {
+    uint64_t bits = getLE32(p) | (uint64_t) getLE32(p + 4) << 32;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+static void putLE32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+static void putLEDouble(uint8_t *p, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    putLE32(p, bits);
+    putLE32(p + 4, bits >> 32);
+}
+
+/*
+ * Binary Files
+ */
+
+/*
+ * Whether the file at path is a binary k grid,
+ * going by its magic number.
+ */
+int isBinaryKGrid(const char *path) {
+    char magic[8];
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return 0;
+    int binary = fread(magic, 1, 8, fp) == 8 && memcmp(magic, KGRID_MAGIC, 8) == 0;
+    fclose(fp);
+    return binary;
+}
+
+/*
+ * Check a binary k grid header and take the grid's
+ * coordinates from it. Returns 0, or -1 if it is not
+ * a grid of the size M writes.
+ */
+static int getKGridHeader(const uint8_t *header, struct KGrid *grid, uint32_t *valueSize, uint32_t *offset, uint32_t *flags) {
+    if (getLE32(header + 12) != KGRID_COLUMNS || getLE32(header + 16) != KGRID_ROWS) return -1;
+    return getKGridFields(header, grid, valueSize, offset, flags);
+}
+
+/* the header of a grid of any size, which is then up to the caller to check */
+static int getKGridFields(const uint8_t *header, struct KGrid *grid, uint32_t *valueSize, uint32_t *offset, uint32_t *flags) {
+    if (memcmp(header, KGRID_MAGIC, 8) != 0) return -1;
+    if (getLE32(header + 8) != KGRID_VERSION) return -1;
+
+    *valueSize = getLE32(header + 28);
+    *offset = getLE32(header + 56);
+    *flags = getLE32(header + 60);
+    if (*valueSize != 2 && *valueSize != 4) return -1;
+    if (*offset < KGRID_HEADER) return -1;
+
+    grid->min = (int32_t) getLE32(header + 24);
+    grid->swX = getLEDouble(header + 32);
+    grid->swY = getLEDouble(header + 40);
+    grid->BOT = getLEDouble(header + 48);
+    grid->binary = 1;
+    return 0;
+}
+
+/* read one column of k values */
+static const uint8_t* getKGridColumn(const uint8_t *k, uint32_t valueSize, int *column) {
+    if (valueSize == 2) {
+        for (int j = 0; j < KGRID_ROWS; j++, k += 2) column[j] = k[0] | k[1] << 8;
+    } else {
+        for (int j = 0; j < KGRID_ROWS; j++, k += 4) column[j] = (int) getLE32(k);
+    }
+    return k;
+}
+
+/*
+ * Decode the k values of a binary k grid held in
+ * memory into pix. Returns 0, or -1 if it is not a
+ * well formed grid of the size M writes.
+ */
+static int decodeKGrid(const uint8_t *data, size_t size, struct KGrid *grid, int pix[][KGRID_STRIDE]) {
+    uint32_t valueSize, offset, flags;
+    if (size < KGRID_HEADER || getKGridHeader(data, grid, &valueSize, &offset, &flags) != 0) return -1;
+    size_t values = (size_t) KGRID_COLUMNS * KGRID_ROWS * valueSize;
+    size_t trailer = flags & KGRID_MIN_AT_END ? 4 : 0;
+    if (offset > size || size - offset < values + trailer) return -1;
+
+    const uint8_t *k = data + offset;
+    for (int i = 0; i < KGRID_COLUMNS; i++) k = getKGridColumn(k, valueSize, pix[i]);
+    if (trailer) grid->min = (int32_t) getLE32(k);
+    return 0;
+}
+
+/*
+ * Read a k grid in either format into pix. Binary
+ * files are mapped rather than read where possible,
+ * and binary grids can also come down a pipe (or "-"
+ * for standard input).
+ * Returns 0, or -1 if the file could not be read.
+ */
+int readKGrid(const char *path, struct KGrid *grid, int pix[][KGRID_STRIDE]) {
+#if defined KGRID_MAPPED
+    if (isKGridStream(path)) {
+        FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+        if (fp == NULL) return -1;
+        struct KGridReader *reader = startKGridReader(fp, grid);
+        int result = reader ? 0 : -1;
+        for (int i = 0; i < KGRID_COLUMNS && result == 0; i++) result = readKGridColumn(reader, pix[i]);
+        if (reader && finishKGridReader(reader, grid) != 0) result = -1;
+        if (fp != stdin) fclose(fp);
+        return result;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if (fd < 0) return -1;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    int result;
+    if (status.st_size >= 8 && memcmp(data, KGRID_MAGIC, 8) == 0) {
+        result = decodeKGrid(data, status.st_size, grid, pix);
+    } else {
+        madvise(data, status.st_size, MADV_SEQUENTIAL);
+        result = parseTextKGrid(data, status.st_size, grid, pix);
+    }
+    munmap(data, status.st_size);
+    return result;
+#else
+    if (!isBinaryKGrid(path)) {
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) return -1;
+        int result = readTextKGrid(fp, grid, pix);
+        fclose(fp);
+        return result;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return -1;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = size > 0 ? malloc(size) : NULL;
+    int result = data && fread(data, 1, size, fp) == (size_t) size ? decodeKGrid(data, size, grid, pix) : -1;
+    free(data);
+    fclose(fp);
+    return result;
+#endif
+}
+
+static void putKGridHeader(uint8_t *header, const struct KGrid *grid, uint32_t valueSize) {
+    memset(header, 0, KGRID_HEADER);
+    memcpy(header, KGRID_MAGIC, 8);
+    putLE32(header + 8, KGRID_VERSION);
+    putLE32(header + 12, KGRID_COLUMNS);
+    putLE32(header + 16, KGRID_ROWS);
+    putLE32(header + 20, KGRID_MAX_K);
+    putLE32(header + 24, (uint32_t) grid->min);
+    putLE32(header + 28, valueSize);
+    putLEDouble(header + 32, grid->swX);
+    putLEDouble(header + 40, grid->swY);
+    putLEDouble(header + 48, grid->BOT);
+    putLE32(header + 56, KGRID_HEADER);
+}
+
+/*
+ * Write pix as a binary k grid, with 16 bit values
+ * unless some k value does not fit. Returns 0, or -1
+ * if the write failed.
+ */
+int writeKGrid(FILE *fp, const struct KGrid *grid, int pix[][KGRID_STRIDE]) {
+    uint32_t valueSize = 2;
+    for (int i = 0; i < KGRID_COLUMNS; i++) {
+        for (int j = 0; j < KGRID_ROWS; j++) {
+            if (pix[i][j] < 0 || pix[i][j] > 0xFFFF) valueSize = 4;
+        }
+    }
+
+    uint8_t header[KGRID_HEADER];
+    putKGridHeader(header, grid, valueSize);
+    if (fwrite(header, 1, KGRID_HEADER, fp) != KGRID_HEADER) return -1;
+
+    // One column at a time
+    uint8_t column[KGRID_ROWS * 4];
+    for (int i = 0; i < KGRID_COLUMNS; i++) {
+        uint8_t *k = column;
+        for (int j = 0; j < KGRID_ROWS; j++) {
+            if (valueSize == 2) {
+                *k++ = pix[i][j];
+                *k++ = pix[i][j] >> 8;
+            } else {
+                putLE32(k, pix[i][j]);
+                k += 4;
+            }
+        }
+        if (fwrite(column, 1, k - column, fp) != (size_t) (k - column)) return -1;
+    }
+    return fflush(fp) == 0 ? 0 : -1;
+}
+
+/*
+ * Streaming
+ *
+ * The k values of a column are final once it is
+ * computed, and binary grids are column by column, so
+ * M writes them out as it goes rather than holding the
+ * whole grid. Columns are gathered into a buffer,
+ * which a thread writes while the next one fills.
+ * The lowest k value is only known at the end, so it
+ * is filled into the header last, or when writing to
+ * a pipe, sent after the k values. Columns go down a
+ * pipe a few at a time, for whatever is reading them
+ * to keep up.
+ */
+
+#if defined KGRID_THREADED
+static void* writeBuffers(void *arg) {
+    struct KGridWriter *writer = arg;
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (!writer->pending && !writer->finished) pthread_cond_wait(&writer->changed, &writer->lock);
+        if (!writer->pending) break;
+
+        pthread_mutex_unlock(&writer->lock);
+        int written = fwrite(writer->writing, 1, writer->pending, writer->fp) == writer->pending;
+        if (written && writer->streaming) written = fflush(writer->fp) == 0;
+        pthread_mutex_lock(&writer->lock);
+        if (!written) writer->failed = 1;
+        writer->pending = 0;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+#endif
+
+/* pass the filled buffer on to be written, and start on the other */
+static void handOffBuffer(struct KGridWriter *writer) {
+#if defined KGRID_THREADED
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending) pthread_cond_wait(&writer->changed, &writer->lock);
+    writer->writing = writer->buffers[writer->filling];
+    writer->pending = writer->used;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    writer->filling ^= 1;
+#else
+    if (fwrite(writer->buffers[writer->filling], 1, writer->used, writer->fp) != writer->used) writer->failed = 1;
+    if (writer->streaming && fflush(writer->fp) != 0) writer->failed = 1;
+#endif
+    writer->used = 0;
+}
+
+/*
+ * Start writing a binary k grid to fp. Its columns are then given one at a time
+ * with writeKGridColumn, and the grid ended with
+ * finishKGrid. Returns NULL if it could not start.
+ */
+struct KGridWriter* startKGrid(FILE *fp, const struct KGrid *grid) {
+    struct KGridWriter *writer = calloc(1, sizeof(struct KGridWriter));
+    if (!writer) return NULL;
+    writer->fp = fp;
+    writer->start = ftell(fp);
+    writer->streaming = writer->start < 0;
+    writer->batch = writer->streaming ? KGRID_STREAM_COLUMNS : KGRID_BUFFER_COLUMNS;
+    writer->buffers[0] = malloc(KGRID_BUFFER_COLUMNS * KGRID_ROWS * 2);
+    writer->buffers[1] = malloc(KGRID_BUFFER_COLUMNS * KGRID_ROWS * 2);
+
+    uint8_t header[KGRID_HEADER];
+    putKGridHeader(header, grid, 2);
+    if (writer->streaming) {
+        putLE32(header + 24, 0);
+        putLE32(header + 60, KGRID_MIN_AT_END);
+    }
+    if (!writer->buffers[0] || !writer->buffers[1] ||
+        fwrite(header, 1, KGRID_HEADER, fp) != KGRID_HEADER) {
+        free(writer->buffers[0]);
+        free(writer->buffers[1]);
+        free(writer);
+        return NULL;
+    }
+
+#if defined KGRID_THREADED
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    if (pthread_create(&writer->thread, NULL, writeBuffers, writer) != 0) {
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->changed);
+        free(writer->buffers[0]);
+        free(writer->buffers[1]);
+        free(writer);
+        return NULL;
+    }
+#endif
+    return writer;
+}
+
+/*
+ * Add the next column of k values, KGRID_ROWS of them,
+ * each of which must fit in 16 bits. Returns 0, or -1
+ * if the grid can no longer be written.
+ */
+int writeKGridColumn(struct KGridWriter *writer, const int *column) {
+    if (writer->failed || writer->columns == KGRID_COLUMNS) return -1;
+    if (writer->used == (size_t) writer->batch * KGRID_ROWS * 2) handOffBuffer(writer);
+
+    uint8_t *k = writer->buffers[writer->filling] + writer->used;
+    for (int j = 0; j < KGRID_ROWS; j++) {
+        if (column[j] < 0 || column[j] > 0xFFFF) {
+            writer->failed = 1;
+            return -1;
+        }
+        *k++ = column[j];
+        *k++ = column[j] >> 8;
+    }
+    writer->used += KGRID_ROWS * 2;
+    writer->columns++;
+    return 0;
+}
+
+/*
+ * Write out the last columns, and the lowest k value
+ * into the header. The writer is freed either way.
+ * Returns 0, or -1 if the grid could not be written
+ * or is missing columns.
+ */
+int finishKGrid(struct KGridWriter *writer, int min) {
+    if (writer->used > 0) handOffBuffer(writer);
+#if defined KGRID_THREADED
+    pthread_mutex_lock(&writer->lock);
+    writer->finished = 1;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->changed);
+#endif
+
+    uint8_t field[4];
+    putLE32(field, (uint32_t) min);
+    int result = writer->failed || writer->columns != KGRID_COLUMNS ? -1 : 0;
+    if (result == 0 && writer->streaming) {
+        if (fwrite(field, 1, 4, writer->fp) != 4 || fflush(writer->fp) != 0) result = -1;
+    } else if (result == 0) {
+        long end = ftell(writer->fp);
+        if (end < 0 || fseek(writer->fp, writer->start + 24, SEEK_SET) != 0 ||
+            fwrite(field, 1, 4, writer->fp) != 4 || fseek(writer->fp, end, SEEK_SET) != 0 ||
+            fflush(writer->fp) != 0) result = -1;
+    }
+
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    free(writer);
+    return result;
+}
+
+/*
+ * Whether path is a pipe (or "-", standard input),
+ * which can only be read through from the start.
+ */
+int isKGridStream(const char *path) {
+    if (strcmp(path, "-") == 0) return 1;
+#if defined KGRID_MAPPED
+    struct stat status;
+    return stat(path, &status) == 0 && S_ISFIFO(status.st_mode);
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Start reading a binary k grid from fp, taking its
+ * coordinates (and lowest k value, if it is there
+ * yet) into grid. Its columns are then read one at a
+ * time with readKGridColumn, as they arrive. Returns
+ * NULL if it is not a binary k grid.
+ */
+struct KGridReader* startKGridReader(FILE *fp, struct KGrid *grid) {
+    uint8_t header[KGRID_HEADER];
+    uint32_t valueSize, offset, flags;
+    if (fread(header, 1, KGRID_HEADER, fp) != KGRID_HEADER) return NULL;
+    if (getKGridHeader(header, grid, &valueSize, &offset, &flags) != 0) return NULL;
+    for (uint32_t skip = KGRID_HEADER; skip < offset; skip++) {
+        if (fgetc(fp) == EOF) return NULL;
+    }
+
+    struct KGridReader *reader = malloc(sizeof(struct KGridReader));
+    if (!reader) return NULL;
+    reader->fp = fp;
+    reader->valueSize = valueSize;
+    reader->flags = flags;
+    reader->columns = 0;
+    return reader;
+}
+
+/*
+ * Read the next column of k values into column,
+ * waiting for it if need be. Returns 0, or -1 if the
+ * grid ended early or has no more columns.
+ */
+int readKGridColumn(struct KGridReader *reader, int *column) {
+    uint8_t k[KGRID_ROWS * 4];
+    size_t bytes = KGRID_ROWS * reader->valueSize;
+    if (reader->columns == KGRID_COLUMNS || fread(k, 1, bytes, reader->fp) != bytes) return -1;
+    getKGridColumn(k, reader->valueSize, column);
+    reader->columns++;
+    return 0;
+}
+
+/*
+ * Finish reading a k grid, taking the lowest k value
+ * into grid if it came after the k values. The reader
+ * is freed either way. Returns 0, or -1 if the grid
+ * was cut short.
+ */
+int finishKGridReader(struct KGridReader *reader, struct KGrid *grid) {
+    int result = reader->columns == KGRID_COLUMNS ? 0 : -1;
+    if (result == 0 && reader->flags & KGRID_MIN_AT_END) {
+        uint8_t field[4];
+        if (fread(field, 1, 4, reader->fp) == 4) {
+            grid->min = (int32_t) getLE32(field);
+        } else {
+            result = -1;
+        }
+    }
+    free(reader);
+    return result;
+}
+
+/*
+ * Text Files
+ */
+
+/*  data looks like this:
+
+-2.50000000000000000000
+-1.25000000000000000000
+3.50000000000000000000
+1
+1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000
+1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000
+                     ...etc
+
+    16 columns of data at a time, 405 rows each, then the last 3 columns */
+
+#if defined KGRID_MAPPED
+/*
+ * Parse one integer, skipping the white space (and
+ * any other control characters) before it, the way
+ * %i does for decimals. Returns where it
+ * ends, or NULL if there is none before end or
+ * it has too many digits to fit.
+ */
+static const char* parseKValue(const char *p, const char *end, int *value) {
+    // Fast path: a separator then a %4i field, read 4 characters at a time
+    if (end - p > 5 && (unsigned char) p[0] <= ' ' && (unsigned) (p[5] - '0') > 9) {
+        const uint8_t *f = (const uint8_t*) p + 1;
+        uint32_t field = f[0] | f[1] << 8 | f[2] << 16 | (uint32_t) f[3] << 24;
+        uint32_t digits = field | 0x10101010;                    /* spaces to '0' */
+        uint32_t spaces = (field ^ 0x20202020) + 0x7F7F7F7F;     /* high bit set where not a space */
+        spaces = ~spaces & 0x80808080 & ~(field & 0x80808080);
+        int valid = (((digits + 0x46464646) | (digits - 0x30303030)) & 0x80808080) == 0;
+        /* spaces only leading, and the field must end in a digit */
+        if (valid && (spaces == 0 || spaces == 0x80 || spaces == 0x8080 || spaces == 0x808080) &&
+            ((field ^ digits) & ~(spaces >> 3)) == 0) {
+            uint32_t d = digits - 0x30303030;
+            d = (d * 10 + (d >> 8)) & 0x00FF00FF;                /* two pairs of digits */
+            *value = (d & 0xFF) * 100 + (d >> 16);
+            return p + 5;
+        }
+    }
+
+    while (p < end && (unsigned char) *p <= ' ') p++;
+    int negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+    if (p == end || (unsigned) (*p - '0') > 9) return NULL;
+
+    int n = 0;
+    do {
+        n = n * 10 + (*p++ - '0');
+    } while (p < end && (unsigned) (*p - '0') <= 9 && n < 100000000);
+    if (p < end && (unsigned) (*p - '0') <= 9) return NULL;  /* too many digits for an int */
+    *value = negative ? -n : n;
+    return p;
+}
+
+struct TextStrips {
+    const char *starts[KGRID_STRIPS + 1]; /* start of each strip, then the end of the data */
+    int (*pix)[KGRID_STRIDE];
+#if !defined SINGLE_THREADED
+    atomic_int next;                      /* strip to parse next */
+    atomic_int failed;
+#endif
+};
+
+/* parse strip k, 16 columns (or the last 3) by 405 rows */
+static int parseStrip(struct TextStrips *strips, int k) {
+    const char *p = strips->starts[k];
+    const char *end = strips->starts[k + 1];
+    int i = k * KGRID_STRIP;
+    int width = k < KGRID_STRIPS - 1 ? KGRID_STRIP : KGRID_COLUMNS - i;
+    for (int j = 0; j < KGRID_ROWS; j++) {
+        for (int c = 0; c < width; c++) {
+            p = parseKValue(p, end, &strips->pix[i + c][j]);
+            if (!p) return -1;
+        }
+    }
+    return 0;
+}
+
+#if !defined SINGLE_THREADED
+static void* parseStrips(void *arg) {
+    struct TextStrips *strips = arg;
+    int k;
+    while ((k = atomic_fetch_add(&strips->next, 1)) < KGRID_STRIPS) {
+        if (parseStrip(strips, k) != 0) atomic_store(&strips->failed, 1);
+    }
+    return NULL;
+}
+#endif
+
+/*
+ * Parse a text k grid held in memory into pix. Each
+ * strip starts 405 lines after the last, so strips
+ * are found by hopping from line to line with memchr
+ * and can then be parsed side by side. Returns 0, or
+ * -1 if it is not a well formed grid.
+ */
+static int parseTextKGrid(const char *data, size_t size, struct KGrid *grid, int pix[][KGRID_STRIDE]) {
+    const char *end = data + size;
+
+    // The header is parsed from a terminated copy, as the mapping isn't
+    char header[256];
+    size_t length = size < sizeof(header) - 1 ? size : sizeof(header) - 1;
+    memcpy(header, data, length);
+    header[length] = 0;
+    int used;
+    if (sscanf(header, "%lf %lf %lf %i%n", &grid->swX, &grid->swY, &grid->BOT, &grid->min, &used) != 4) return -1;
+    grid->binary = 0;
+
+    // Strip k starts after the header's last line and 405 lines per strip
+    struct TextStrips strips;
+    strips.pix = pix;
+    const char *p = data + used;
+    for (int k = 0; k < KGRID_STRIPS; k++) {
+        for (int line = k == 0 ? 1 : KGRID_ROWS; line > 0; line--) {
+            const char *newline = memchr(p, '\n', end - p);
+            if (!newline) return -1;
+            p = newline + 1;
+        }
+        strips.starts[k] = p;
+    }
+    strips.starts[KGRID_STRIPS] = end;
+
+#if !defined SINGLE_THREADED
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus < 1 ? 1 : cpus > KGRID_THREADS ? KGRID_THREADS : cpus;
+    if (threads > 1) {
+        pthread_t workers[KGRID_THREADS];
+        atomic_init(&strips.next, 0);
+        atomic_init(&strips.failed, 0);
+        int started = 0;
+        for (; started < threads - 1; started++) {
+            if (pthread_create(&workers[started], NULL, parseStrips, &strips) != 0) break;
+        }
+        parseStrips(&strips); /* lend a hand */
+        for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+        return atomic_load(&strips.failed) ? -1 : 0;
+    }
+#endif
+    for (int k = 0; k < KGRID_STRIPS; k++) {
+        if (parseStrip(&strips, k) != 0) return -1;
+    }
+    return 0;
+}
+#endif
+
+int readTextKGrid(FILE *fp, struct KGrid *grid, int pix[][KGRID_STRIDE]) {
+    int i, j, k;
+
+    if (fscanf(fp, "%lf %lf %lf %i", &grid->swX, &grid->swY, &grid->BOT, &grid->min) != 4) return -1;
+    grid->binary = 0;
+
+    for ( k = 0; k <= 36; k++) {
+        i = k * 16;                         /* 16 columns of data at a time */
+        for ( j = 0; j <= 404; j++) {       /* rows */
+            if (k == 36) {
+                if (fscanf(fp,"%i %i %i\n",
+                       &pix[i][j], &pix[i+1][j], &pix[i+2][j]) != 3) return -1;
+            }
+            if (k < 36) {
+                if (fscanf(fp,
+                "%i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i\n",
+                &pix[i][j], &pix[i+1][j], &pix[i+2][j], &pix[i+3][j],
+                &pix[i+4][j], &pix[i+5][j], &pix[i+6][j], &pix[i+7][j],
+                &pix[i+8][j], &pix[i+9][j], &pix[i+10][j], &pix[i+11][j],
+                &pix[i+12][j], &pix[i+13][j], &pix[i+14][j], &pix[i+15][j]) != 16) return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Put value as %4i does, then the separator. Returns
+ * where it ends.
+ */
+static char* putKText(char *out, int value, char separator) {
+    if (value < 0 || value > 9999) {
+        out += sprintf(out, "%4i", value);
+    } else {
+        out[0] = value >= 1000 ? '0' + value / 1000 : ' ';
+        out[1] = value >= 100 ? '0' + value / 100 % 10 : ' ';
+        out[2] = value >= 10 ? '0' + value / 10 % 10 : ' ';
+        out[3] = '0' + value % 10;
+        out += 4;
+    }
+    *out++ = separator;
+    return out;
+}
+
+int writeTextKGrid(FILE *fp, const struct KGrid *grid, int pix[][KGRID_STRIDE]) {
+    int i, j, k;
+
+    fprintf(fp,"%23.20f\n%23.20f\n%22.20f\n%i\n",
+                  grid->swX, grid->swY, grid->BOT, grid->min);
+
+    /* a strip at a time, at most 12 characters per value (%4i of any int) */
+    char *strip = malloc(KGRID_ROWS * KGRID_STRIP * 12);
+    if (strip == NULL) return -1;
+    for ( k = 0; k < KGRID_STRIPS; k++) {
+        i = k * KGRID_STRIP;                 /* 16 columns of data at a time */
+        int width = k < KGRID_STRIPS - 1 ? KGRID_STRIP : KGRID_COLUMNS - i;
+        char *out = strip;
+        for ( j = 0; j < KGRID_ROWS; j++) {  /* rows */
+            for (int c = 0; c < width; c++) {
+                out = putKText(out, pix[i + c][j], c < width - 1 ? ' ' : '\n');
+            }
+        }
+        if (fwrite(strip, 1, out - strip, fp) != (size_t) (out - strip)) {
+            free(strip);
+            return -1;
+        }
+    }
+    free(strip);
+    return fflush(fp) == 0 ? 0 : -1;
+}
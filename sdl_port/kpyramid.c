@@ -0,0 +1,352 @@
+/*
+ * K Grid Pyramids
+ *
+ * A binary k grid of any size, for browsing in COLOR.
+ * A render of many gigapixels can't be read into pix,
+ * so the file is mapped instead, and only the part of
+ * it that is on the screen is ever read from disk.
+ *
+ * Zoomed out, that would still be all of it, so the
+ * grid is kept with a pyramid of smaller levels: each
+ * level takes every other column and row of the one
+ * below, which makes level L the grid M would have
+ * computed with 2^L times the grid interval, down to
+ * one that fits the screen. They are sampled rather
+ * than averaged, as a k value is a count and an
+ * average of counts would blur the bands. Drawing
+ * then uses the level with between 1 and 2 samples
+ * per pixel, so a screen never reads more than a few
+ * screens' worth of k values.
+ *
+ * The levels are built once and kept next to the grid
+ * in a sidecar file, path.mip, which is rebuilt if
+ * the grid changes (or kept in memory if it can't be
+ * written). A rebuilt sidecar is written under a
+ * temporary name and renamed over the old one, which
+ * another process may still have mapped:
+ *
+ *     offset  size  field
+ *          0     8  magic, "MANDKMIP"
+ *          8     4  version, 2
+ *         12     4  levels, counting the grid itself
+ *         16     4  columns of the grid
+ *         20     4  rows of the grid
+ *         24     8  size of the grid file
+ *         32     8  modification time of the grid file (seconds)
+ *         40     8  and its nanoseconds
+ *         64        levels 1 and up, 16 bit k values in host
+ *                   byte order, column by column
+ *
+ * Included by color.c after kgrid.c.
+ */
+
+#if defined KGRID_MAPPED
+
+#include <math.h>
+
+#define KPYRAMID_MAGIC "MANDKMIP"
+#define KPYRAMID_VERSION 2
+#define KPYRAMID_HEADER 64
+#define KPYRAMID_LEVELS 32
+
+/* columns of a level handed to a thread at a time while building */
+#define KPYRAMID_BATCH 64
+
+/* pixels off the edge of the grid, opaque black */
+#define KPYRAMID_OUTSIDE 0x000000FF
+
+struct KPyramid {
+    int columns;              /* of the grid itself, level 0 */
+    int rows;
+    int levels;
+    int widths[KPYRAMID_LEVELS];   /* columns and rows of each level */
+    int heights[KPYRAMID_LEVELS];
+    void *data;               /* the grid file, mapped */
+    size_t size;
+    const uint8_t *base;      /* its k values */
+    uint32_t valueSize;
+    void *mip;                /* levels 1 and up, the sidecar mapped (or memory) */
+    size_t mipSize;
+    uint16_t *k[KPYRAMID_LEVELS];  /* k values of each level from 1 */
+};
+
+struct KPyramid* openKPyramid(const char*, struct KGrid*);
+void closeKPyramid(struct KPyramid*);
+void drawKPyramid(const struct KPyramid*, double, double, double, const uint32_t*, uint32_t*, int, int);
+
+/* a k value of the grid itself */
+static int baseK(const struct KPyramid *pyr, size_t i, size_t j) {
+    const uint8_t *v = pyr->base + (i * pyr->rows + j) * pyr->valueSize;
+    return pyr->valueSize == 2 ? v[0] | v[1] << 8 : (int) getLE32(v);
+}
+
+/* sample columns from up to to of a level from the one below */
+static void sampleColumns(struct KPyramid *pyr, int level, int from, int to) {
+    int height = pyr->heights[level];
+    uint16_t *out = pyr->k[level] + (size_t) from * height;
+    for (int i = from; i < to; i++) {
+        if (level == 1) {
+            for (int j = 0; j < height; j++) {
+                int k = baseK(pyr, (size_t) i * 2, (size_t) j * 2);
+                *out++ = k < 0 ? 0 : k > 0xFFFF ? 0xFFFF : k;
+            }
+        } else {
+            const uint16_t *below = pyr->k[level - 1] + (size_t) i * 2 * pyr->heights[level - 1];
+            for (int j = 0; j < height; j++) *out++ = below[j * 2];
+        }
+    }
+}
+
+#if defined KGRID_THREADED
+struct PyramidLevel {
+    struct KPyramid *pyr;
+    int level;
+    atomic_int next;          /* column to sample next */
+};
+
+static void* sampleBatches(void *arg) {
+    struct PyramidLevel *work = arg;
+    int width = work->pyr->widths[work->level];
+    int i;
+    while ((i = atomic_fetch_add(&work->next, KPYRAMID_BATCH)) < width) {
+        sampleColumns(work->pyr, work->level, i, i + KPYRAMID_BATCH < width ? i + KPYRAMID_BATCH : width);
+    }
+    return NULL;
+}
+#endif
+
+/*
+ * Build the levels above the grid, each from the one
+ * below, with the columns of each split between
+ * threads (unless built with -DSINGLE_THREADED).
+ */
+static void buildKPyramid(struct KPyramid *pyr) {
+    madvise(pyr->data, pyr->size, MADV_SEQUENTIAL);
+    for (int level = 1; level < pyr->levels; level++) {
+#if defined KGRID_THREADED
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int threads = cpus < 1 ? 1 : cpus > KGRID_THREADS ? KGRID_THREADS : cpus;
+        if (threads > 1 && pyr->widths[level] > KPYRAMID_BATCH) {
+            pthread_t workers[KGRID_THREADS];
+            struct PyramidLevel work;
+            work.pyr = pyr;
+            work.level = level;
+            atomic_init(&work.next, 0);
+            int started = 0;
+            for (; started < threads - 1; started++) {
+                if (pthread_create(&workers[started], NULL, sampleBatches, &work) != 0) break;
+            }
+            sampleBatches(&work); /* lend a hand */
+            for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+            continue;
+        }
+#endif
+        sampleColumns(pyr, level, 0, pyr->widths[level]);
+    }
+}
+
+/* point each level above the grid at its k values in the sidecar */
+static void placeLevels(struct KPyramid *pyr) {
+    uint16_t *k = (uint16_t*) ((uint8_t*) pyr->mip + KPYRAMID_HEADER);
+    for (int level = 1; level < pyr->levels; level++) {
+        pyr->k[level] = k;
+        k += (size_t) pyr->widths[level] * pyr->heights[level];
+    }
+}
+
+static void putKPyramidHeader(uint8_t *header, const struct KPyramid *pyr, const struct stat *status) {
+    memset(header, 0, KPYRAMID_HEADER);
+    memcpy(header, KPYRAMID_MAGIC, 8);
+    putLE32(header + 8, KPYRAMID_VERSION);
+    putLE32(header + 12, pyr->levels);
+    putLE32(header + 16, pyr->columns);
+    putLE32(header + 20, pyr->rows);
+    putLE32(header + 24, (uint64_t) status->st_size);
+    putLE32(header + 28, (uint64_t) status->st_size >> 32);
+    putLE32(header + 32, (uint64_t) status->st_mtime);
+    putLE32(header + 36, (uint64_t) status->st_mtime >> 32);
+    putLE32(header + 40, (uint64_t) status->st_mtim.tv_nsec);
+    putLE32(header + 44, (uint64_t) status->st_mtim.tv_nsec >> 32);
+}
+
+/*
+ * Map the levels above the grid from its sidecar, or
+ * build them if the sidecar is missing or out of
+ * date. Returns 0, or -1 if there is no room for them.
+ */
+static int mapKPyramid(struct KPyramid *pyr, const char *path, const struct stat *status) {
+    uint8_t header[KPYRAMID_HEADER];
+    putKPyramidHeader(header, pyr, status);
+
+    char *mipPath = malloc(strlen(path) + 5);
+    char *tmpPath = malloc(strlen(path) + 32);
+    if (!mipPath || !tmpPath) {
+        free(mipPath);
+        free(tmpPath);
+        return -1;
+    }
+    strcpy(mipPath, path);
+    strcat(mipPath, ".mip");
+    sprintf(tmpPath, "%s.%ld.tmp", mipPath, (long) getpid());
+
+    // Use the sidecar as it is if it was built from this very grid
+    uint8_t found[KPYRAMID_HEADER];
+    struct stat mipStatus;
+    int fd = open(mipPath, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &mipStatus) == 0 && (size_t) mipStatus.st_size == pyr->mipSize &&
+        pread(fd, found, KPYRAMID_HEADER, 0) == KPYRAMID_HEADER && memcmp(found, header, KPYRAMID_HEADER) == 0) {
+        pyr->mip = mmap(NULL, pyr->mipSize, PROT_READ, MAP_SHARED, fd, 0);
+    } else {
+        pyr->mip = MAP_FAILED;
+    }
+    if (fd >= 0) close(fd);
+    if (pyr->mip != MAP_FAILED) {
+        free(mipPath);
+        free(tmpPath);
+        placeLevels(pyr);
+        return 0;
+    }
+
+    /* Otherwise build it in a file of its own, so that a process
+       with the old one mapped never sees it cut short (SIGBUS) */
+    fd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && ftruncate(fd, pyr->mipSize) == 0) {
+        pyr->mip = mmap(NULL, pyr->mipSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int saved = pyr->mip != MAP_FAILED;
+    if (fd >= 0 && !saved) unlink(tmpPath);
+    if (!saved) pyr->mip = mmap(NULL, pyr->mipSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pyr->mip == MAP_FAILED) {
+        pyr->mip = NULL;
+        if (fd >= 0) close(fd);
+        free(mipPath);
+        free(tmpPath);
+        return -1;
+    }
+    placeLevels(pyr);
+    buildKPyramid(pyr);
+    if (saved) {
+        memcpy(pyr->mip, header, KPYRAMID_HEADER);
+        if (msync(pyr->mip, pyr->mipSize, MS_SYNC) != 0 || rename(tmpPath, mipPath) != 0) unlink(tmpPath);
+    }
+    if (fd >= 0) close(fd);
+    free(mipPath);
+    free(tmpPath);
+    return 0;
+}
+
+/*
+ * Open a binary k grid of any size for drawing, with
+ * its pyramid, and take its coordinates. Returns NULL
+ * if it is not a well formed binary grid.
+ */
+struct KPyramid* openKPyramid(const char *path, struct KGrid *grid) {
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if (fd < 0) return NULL;
+    if (fstat(fd, &status) != 0 || status.st_size < KGRID_HEADER) {
+        close(fd);
+        return NULL;
+    }
+    struct KPyramid *pyr = calloc(1, sizeof(struct KPyramid));
+    void *data = pyr ? mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) {
+        free(pyr);
+        return NULL;
+    }
+    pyr->data = data;
+    pyr->size = status.st_size;
+
+    uint32_t offset, flags;
+    if (getKGridFields(data, grid, &pyr->valueSize, &offset, &flags) != 0) {
+        closeKPyramid(pyr);
+        return NULL;
+    }
+    pyr->columns = getLE32((uint8_t*) data + 12);
+    pyr->rows = getLE32((uint8_t*) data + 16);
+    uint64_t values = (uint64_t) (uint32_t) pyr->columns * (uint32_t) pyr->rows * pyr->valueSize;
+    size_t trailer = flags & KGRID_MIN_AT_END ? 4 : 0;
+    if (pyr->columns <= 0 || pyr->rows <= 0 || offset > pyr->size || pyr->size - offset < values + trailer) {
+        closeKPyramid(pyr);
+        return NULL;
+    }
+    pyr->base = (uint8_t*) data + offset;
+    if (trailer) grid->min = (int32_t) getLE32(pyr->base + values);
+
+    // Halve until a level fits the screen
+    pyr->widths[0] = pyr->columns;
+    pyr->heights[0] = pyr->rows;
+    pyr->levels = 1;
+    pyr->mipSize = KPYRAMID_HEADER;
+    while (pyr->levels < KPYRAMID_LEVELS &&
+           (pyr->widths[pyr->levels - 1] > KGRID_COLUMNS || pyr->heights[pyr->levels - 1] > KGRID_ROWS)) {
+        int level = pyr->levels++;
+        pyr->widths[level] = (pyr->widths[level - 1] + 1) / 2;
+        pyr->heights[level] = (pyr->heights[level - 1] + 1) / 2;
+        pyr->mipSize += (size_t) pyr->widths[level] * pyr->heights[level] * sizeof(uint16_t);
+    }
+    if (pyr->levels > 1 && mapKPyramid(pyr, path, &status) != 0) {
+        closeKPyramid(pyr);
+        return NULL;
+    }
+
+    // From here on, only what is on the screen is read
+    madvise(pyr->data, pyr->size, MADV_RANDOM);
+    return pyr;
+}
+
+void closeKPyramid(struct KPyramid *pyr) {
+    if (pyr->mip) munmap(pyr->mip, pyr->mipSize);
+    munmap(pyr->data, pyr->size);
+    free(pyr);
+}
+
+/*
+ * Color in an image of width x height pixels, row by
+ * row, with the grid seen from column left and row top
+ * (of the grid itself) at scale of its columns per
+ * pixel, each k value colored by lut (k values above
+ * 1000 sharing its last entry). Only the k values of
+ * the one level drawn that fall on a pixel are read.
+ */
+void drawKPyramid(const struct KPyramid *pyr, double left, double top, double scale,
+                  const uint32_t *lut, uint32_t *image, int width, int height) {
+    int level = 0;
+    while (level + 1 < pyr->levels && ldexp(1, level + 1) <= scale) level++;
+    double step = scale / ldexp(1, level);          /* samples of the level per pixel */
+    double x = left / ldexp(1, level);
+    double y = top / ldexp(1, level);
+    int levelWidth = pyr->widths[level];
+    int levelHeight = pyr->heights[level];
+
+    // The row of the level on each row of the image, -1 where there is none
+    int *rows = malloc(height * sizeof(int));
+    if (!rows) return;
+    for (int j = 0; j < height; j++) {
+        double row = floor(y + (j + 0.5) * step);
+        rows[j] = row >= 0 && row < levelHeight ? (int) row : -1;
+    }
+
+    // Columns outer, as the levels are stored column by column
+    for (int i = 0; i < width; i++) {
+        double column = floor(x + (i + 0.5) * step);
+        uint32_t *out = image + i;
+        if (column < 0 || column >= levelWidth) {
+            for (int j = 0; j < height; j++, out += width) *out = KPYRAMID_OUTSIDE;
+        } else if (level == 0) {
+            for (int j = 0; j < height; j++, out += width) {
+                int k = rows[j] < 0 ? -1 : baseK(pyr, (size_t) column, rows[j]);
+                *out = k < 0 ? KPYRAMID_OUTSIDE : lut[k > 1000 ? 1000 : k];
+            }
+        } else {
+            const uint16_t *k = pyr->k[level] + (size_t) column * levelHeight;
+            for (int j = 0; j < height; j++, out += width) {
+                *out = rows[j] < 0 ? KPYRAMID_OUTSIDE : lut[k[rows[j]] > 1000 ? 1000 : k[rows[j]]];
+            }
+        }
+    }
+    free(rows);
+}
+
+#endif
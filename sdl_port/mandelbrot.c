@@ -10,8 +10,12 @@
  */
 
 /*
- * To build and run: `gcc sdl_port/mandelbrot.c -lm -lSDL2 -lSDL2_ttf -o mandelbrot && ./mandelbrot`
+ * To build and run: `gcc sdl_port/mandelbrot.c -lm -lpthread -lSDL2 -lSDL2_ttf -o mandelbrot && ./mandelbrot`
  * (must be done in the root project folder)
+ *
+ * To color the frame while it is being computed, make the output
+ * file a named pipe with COLOR reading from it:
+ * `mkfifo frame.k && (./color frame.k &) && ./mandelbrot`
  */
 
 #include <math.h>
@@ -23,6 +27,7 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include "sdl_helpers.c"
+#include "kgrid.c"
 
 #if defined SDL_VERSION
 void renderFrame(char*, char*, int, int, int, int);
@@ -49,13 +54,13 @@ typedef struct FCOMPLEX {double r,i;} fcomplex;
 const int WIDTH = 580;
 const int HEIGHT = 406;
 
-int pix[580][406];          /* screen pixels */
 FILE *fopen();              /* file open function */
 FILE *fpout;                /* output file pointer */
 
 int main()
 {
     int ans;                 /* miscellaneous user response */
+    int column[406];         /* k values of the column being computed */
 #if defined _VRES16COLOR
     long int bluehi;         /* the color bluehi created by macro RGB */
 #elif defined SDL_VERSION
@@ -89,6 +94,7 @@ int main()
     int x2;                  /* x-coord. of NE corner of progress rectangle */
     int y1;                  /* y-coord. of SW corner of progress rectangle */
     int y2;                  /* y-coord. of NE corner of progress rectangle */
+    struct KGridWriter *writer;    /* streams the columns to the output file */
     fcomplex Z;              /* complex solution of equation being tested  */
 
     fcomplex Complex(double,double);
@@ -109,7 +115,7 @@ int main()
     if ((len = strlen(resp)) == 0 || (len == 1 && (resp[0] == 'q'
         || resp[0] == 'Q')))
         exit(0);
-    if ((fpout = fopen(resp, "w")) == NULL) {
+    if ((fpout = fopen(resp, "wb")) == NULL) {
         printf("\n\nError opening file %s ...\nProgram terminated ...\n",
               resp);
         exit(0);
@@ -208,6 +214,13 @@ int main()
     assignPalletColor(9, &bluehi);
 #endif
 
+    struct KGrid grid = { swX, swY, BOT, min, 1 };
+    if ((writer = startKGrid(fpout, &grid)) == NULL) {
+        printf("\n\nError writing file %s ...\nProgram terminated ...\n",
+              resp);
+        exit(0);
+    }
+
     chunk = 1.0;
     x1 = 200;
     y1 = 260;
@@ -255,10 +268,20 @@ int main()
                 SZ = sqrt( (Z.r * Z.r) + (Z.i * Z.i) );
                 if ( SZ > 2 ) break;
             }
-            pix[i][j] = k;
+            column[j] = k;
             if ( k < min ) min = k;
         }
+        writeKGridColumn(writer, column);   /* written out behind us */
+    }
+
+/*****************************
+ *  finish the output file,
+ *  a binary k grid (see kgrid.c)
+ ****************************/
+    if (finishKGrid(writer, min) != 0) {
+        printf("\n\nError writing file %s ...\n", resp);
     }
+    fclose(fpout);
 
 #if defined _VRES16COLOR
     _unregisterfonts();
@@ -271,34 +294,6 @@ int main()
     cleanupGraphics();
 #endif
 
-/*****************************
- *  write output to a file:
- ****************************/
-    fprintf(fpout,"%23.20f\n%23.20f\n%22.20f\n%i\n",
-                  swX, swY, BOT, min);
-
-    for ( k = 0; k <= 36; k++) {
-        i = k * 16;                         /* 16 columns of data at a time */
-        for ( j = 0; j <= 404; j++) {       /* rows */
-            if (k == 36) {
-                fprintf(fpout,"%4i %4i %4i\n", pix[i][j],pix[i+1][j],pix[i+2][j]);
-            }
-            if (k < 36) {
-                fprintf(fpout,
-                "%4i %4i %4i %4i %4i %4i %4i %4i %4i %4i %4i %4i %4i %4i %4i %4i\n",
-                pix[i][j],pix[i+1][j],pix[i+2][j],pix[i+3][j],pix[i+4][j],pix[i+5][j],
-                pix[i+6][j],pix[i+7][j],pix[i+8][j],pix[i+9][j],pix[i+10][j],
-                pix[i+11][j],pix[i+12][j],pix[i+13][j],pix[i+14][j],pix[i+15][j]);
-            }
-        }
-    }
-
-/*  data looks like this:
-
-1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000
-1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000 1000
-                     ...etc    */
-
 }
 
 fcomplex Complex(re,im)
@@ -12,10 +12,22 @@
 #include <SDL2/SDL.h>
 
 #if defined SDL_VERSION
+// Characters that can be printed, from the glyph atlas.
+#define FIRST_GLYPH ' '
+#define LAST_GLYPH '~'
+#define GLYPH_COUNT (LAST_GLYPH - FIRST_GLYPH + 1)
+
+struct Glyph {
+    SDL_Rect rect; // Area of the glyph atlas holding the glyph.
+    int offset;    // Where it is drawn relative to the pen position.
+    int advance;   // How far it moves the pen position.
+};
+
 void setupGraphics(char*, int, int);
 void cleanupGraphics();
 void cleanupAndExit(char*, const char*); 
 void waitForExit();
+void loadGlyphs();
 void newFrame();
 void setColor(Uint8, Uint8, Uint8);
 void assignPalletColor(Uint8, SDL_Color*);
@@ -31,6 +43,8 @@ TTF_Font *font = 0;
 SDL_Color color = { 0x00, 0x00, 0x00, 0xFF };
 SDL_Point position = { 0, 0 };
 SDL_Color pallet[255];
+SDL_Texture *glyphTexture = 0;
+struct Glyph glyphs[GLYPH_COUNT];
 #endif
 
 #if defined SDL_VERSION
@@ -56,11 +70,16 @@ void setupGraphics(char *title, int width, int height) {
     if (!font) {
         cleanupAndExit("Unable to load font.", TTF_GetError());
     }
+    loadGlyphs();
     for (int i = 0; i < 255; i++) {
         pallet[i] = (SDL_Color) { 255, 255, 255, 255 };
     }
 }
 void cleanupGraphics() {
+    if (glyphTexture) {
+        SDL_DestroyTexture(glyphTexture);
+        glyphTexture = 0;
+    }
     if (window) {
         SDL_DestroyWindow(window);
         window = 0;
@@ -95,6 +114,52 @@ void waitForExit() {
         }
     }
 }
+/*
+ * Render each printable character once, in white,
+ * into a single texture, so that printing text does
+ * not need SDL_ttf to render it every time.
+ */
+void loadGlyphs() {
+    SDL_Color white = { 255, 255, 255, 255 };
+    SDL_Surface *surfaces[GLYPH_COUNT];
+    int width = 0;
+    int height = TTF_FontHeight(font);
+
+    // Render the glyphs, laying them out in a single row
+    for (int g = 0; g < GLYPH_COUNT; g++) {
+        char text[2] = { FIRST_GLYPH + g, 0 };
+        int minX = 0;
+        TTF_GlyphMetrics(font, text[0], &minX, 0, 0, 0, &glyphs[g].advance);
+        glyphs[g].offset = minX < 0 ? minX : 0;
+
+        surfaces[g] = TTF_RenderText_Blended(font, text, white);
+        if (!surfaces[g]) {
+            glyphs[g].rect = (SDL_Rect) { 0, 0, 0, 0 };
+            continue;
+        }
+        glyphs[g].rect = (SDL_Rect) { width, 0, surfaces[g]->w, surfaces[g]->h };
+        if (surfaces[g]->h > height) height = surfaces[g]->h;
+        width += surfaces[g]->w;
+    }
+
+    // Copy them into the atlas
+    SDL_Surface *atlas = SDL_CreateRGBSurfaceWithFormat(0, width > 0 ? width : 1, height, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!atlas) {
+        cleanupAndExit("Unable to create glyph atlas.", SDL_GetError());
+    }
+    for (int g = 0; g < GLYPH_COUNT; g++) {
+        if (!surfaces[g]) continue;
+        SDL_SetSurfaceBlendMode(surfaces[g], SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(surfaces[g], NULL, atlas, &glyphs[g].rect);
+        SDL_FreeSurface(surfaces[g]);
+    }
+    glyphTexture = SDL_CreateTextureFromSurface(renderer, atlas);
+    SDL_FreeSurface(atlas);
+    if (!glyphTexture) {
+        cleanupAndExit("Unable to create glyph atlas.", SDL_GetError());
+    }
+    SDL_SetTextureBlendMode(glyphTexture, SDL_BLENDMODE_BLEND);
+}
 void newFrame() {
     SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
     SDL_RenderClear(renderer);
@@ -117,27 +182,21 @@ void setPosition(int x, int y) {
     position.y = y;
 }
 void printText(char *text) {
-    // Render text
-    SDL_Surface *textSurface = TTF_RenderText_Blended(
-        font,
-        text,
-        color
-    );
-    if (!textSurface) {
-        cleanupAndExit("Unable to render text.", TTF_GetError());
-    }
-    SDL_Texture *textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-    if (!textTexture) {
-        cleanupAndExit("Unable create a text texture.", TTF_GetError());
-    }
+    SDL_SetTextureColorMod(glyphTexture, color.r, color.g, color.b);
 
-    // Draw rendered text to screen buffer
-    SDL_Rect dest = { position.x, position.y, textSurface->w, textSurface->h };
-    SDL_RenderCopy(renderer, textTexture, 0, &dest);
+    // Draw text to screen buffer, one glyph from the atlas at a time
+    int x = position.x;
+    char previous = 0;
+    for (char *t = text; *t; t++) {
+        if (*t < FIRST_GLYPH || *t > LAST_GLYPH) continue;
+        struct Glyph *glyph = &glyphs[*t - FIRST_GLYPH];
+        if (previous) x += TTF_GetFontKerningSizeGlyphs(font, previous, *t);
 
-    // Clean up
-    SDL_DestroyTexture(textTexture);
-    SDL_FreeSurface(textSurface);
+        SDL_Rect dest = { x + glyph->offset, position.y, glyph->rect.w, glyph->rect.h };
+        SDL_RenderCopy(renderer, glyphTexture, &glyph->rect, &dest);
+        x += glyph->advance;
+        previous = *t;
+    }
 }
 void drawLineAndSetPosition(int x, int y) {
     SDL_RenderDrawLine(renderer, position.x, position.y, x, y);
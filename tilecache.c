@@ -0,0 +1,341 @@
+#define _DEFAULT_SOURCE // For futimens and flock
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tilecache.h"
+
+// Bytes the files are brought down to once over budget, as a fraction of it.
+#define EVICT_TO 0.75
+
+#define TILE_MAGIC 0x4B4C4954 // "TILK"
+
+// Steps of the grid tile coordinates are snapped to, per gap between points.
+#define SNAP_STEPS 256
+// Significant bits the gap is snapped to.
+#define SNAP_GAP_BITS 32
+
+// What the k values of a tile depend on. Kept free of padding, as it is
+// hashed and compared as bytes.
+struct TileKey {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t maxK;
+    uint16_t precision; // Size of the floating point type points are computed in.
+    uint16_t w;
+    uint16_t h;
+    uint16_t reserved;
+    int64_t real; // Coordinates of the top-left point, in steps of the snapping grid.
+    int64_t imag;
+    double gap;   // Distance between points, snapped.
+};
+
+/*
+ * Snap a gap to SNAP_GAP_BITS significant bits, so
+ * that gaps worked out along different routes (which
+ * may differ in the last few bits) come out the same.
+ */
+static double snapGap(double gap) {
+    int exponent;
+    double mantissa = frexp(gap, &exponent);
+    return ldexp(round(ldexp(mantissa, SNAP_GAP_BITS)), exponent - SNAP_GAP_BITS);
+}
+
+static struct TileKey tileKey(struct Frame *frame, struct Tile tile) {
+    struct TileKey key;
+    memset(&key, 0, sizeof(key));
+    double gap = frameGap(frame->w, frame->columns);
+    key.magic = TILE_MAGIC;
+    key.version = TILE_CACHE_VERSION;
+    key.maxK = frame->maxK;
+    key.precision = sizeof(double);
+    key.w = tile.w;
+    key.h = tile.h;
+    key.gap = snapGap(gap);
+    key.real = llround(frameReal(frame->x, gap, tile.x) / key.gap * SNAP_STEPS);
+    key.imag = llround(frameImag(frame->y, gap, frame->rows, tile.y) / key.gap * SNAP_STEPS);
+    return key;
+}
+
+// 64-bit FNV-1a hash of the key.
+static uint64_t hashKey(const struct TileKey *key) {
+    const uint8_t *bytes = (const uint8_t*) key;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t b = 0; b < sizeof(*key); b++) {
+        hash ^= bytes[b];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static void tilePath(struct TileCache *cache, const struct TileKey *key, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx.k", cache->directory, (unsigned long long) hashKey(key));
+}
+
+static long fileBytes(const struct TileKey *key) {
+    return sizeof(*key) + (long) key->w * key->h * sizeof(unsigned short);
+}
+
+/*
+ * Cache Directory
+ */
+
+// Create a directory and any missing parents. Returns 0, or -1.
+static int makeDirectory(const char *directory) {
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s", directory) >= (int) sizeof(path)) return -1;
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = 0;
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return mkdir(path, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+/*
+ * The cache directory to use when none is given:
+ * mandelbrot under $XDG_CACHE_HOME, or else under
+ * ~/.cache. Returns a newly allocated string, or
+ * NULL if there is no home directory.
+ */
+char* defaultTileCacheDirectory() {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *suffix = "/mandelbrot";
+    if (!base || !*base) {
+        base = getenv("HOME");
+        suffix = "/.cache/mandelbrot";
+    }
+    if (!base || !*base) return NULL;
+
+    char *directory = malloc(strlen(base) + strlen(suffix) + 1);
+    if (!directory) return NULL;
+    strcpy(directory, base);
+    strcat(directory, suffix);
+    return directory;
+}
+
+struct CachedFile {
+    char name[32];
+    long bytes;
+    struct timespec used;
+};
+
+static int compareUse(const void *a, const void *b) {
+    const struct CachedFile *x = a;
+    const struct CachedFile *y = b;
+    if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Count the bytes taken by the tile files and, if
+ * asked to, delete the least recently used (the
+ * modification time of a file is bumped whenever it
+ * is loaded) until they take no more than the given
+ * number of bytes. Returns the bytes they take.
+ */
+static long scanTileCache(struct TileCache *cache, long target) {
+    DIR *dir = opendir(cache->directory);
+    if (!dir) return 0;
+
+    struct CachedFile *files = NULL;
+    int count = 0;
+    int capacity = 0;
+    long bytes = 0;
+    int directory = dirfd(dir);
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        size_t length = strlen(entry->d_name);
+        if (length < 3 || length >= sizeof(files->name) || strcmp(entry->d_name + length - 2, ".k") != 0) continue;
+
+        struct stat status;
+        if (fstatat(directory, entry->d_name, &status, 0) != 0) continue;
+        bytes += status.st_size;
+        if (target < 0) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            struct CachedFile *grown = realloc(files, capacity * sizeof(struct CachedFile));
+            if (!grown) break;
+            files = grown;
+        }
+        strcpy(files[count].name, entry->d_name);
+        files[count].bytes = status.st_size;
+        files[count].used = status.st_mtim;
+        count++;
+    }
+
+    if (target >= 0 && bytes > target) {
+        qsort(files, count, sizeof(struct CachedFile), compareUse);
+        for (int f = 0; f < count && bytes > target; f++) {
+            if (unlinkat(directory, files[f].name, 0) != 0) continue;
+            bytes -= files[f].bytes;
+            atomic_fetch_add(&cache->evicted, 1);
+        }
+    }
+
+    free(files);
+    closedir(dir);
+    return bytes;
+}
+
+/*
+ * Evict tiles, unless another process or thread is
+ * already doing so. The lock file keeps out other
+ * processes, the evicting flag other threads (which
+ * share the lock).
+ */
+static void evictTiles(struct TileCache *cache) {
+    int idle = 0;
+    if (!atomic_compare_exchange_strong(&cache->evicting, &idle, 1)) return;
+    if (flock(cache->lock, LOCK_EX | LOCK_NB) == 0) {
+        long bytes = scanTileCache(cache, (long) (cache->budget * EVICT_TO));
+        atomic_store(&cache->bytes, bytes);
+        flock(cache->lock, LOCK_UN);
+    }
+    atomic_store(&cache->evicting, 0);
+}
+
+/*
+ * Open a tile cache in the given directory, creating
+ * it if needed, whose files may take up to the given
+ * number of bytes. Returns NULL if the directory
+ * cannot be used.
+ */
+struct TileCache* openTileCache(const char *directory, long budget) {
+    if (makeDirectory(directory) != 0) return NULL;
+
+    struct TileCache *cache = malloc(sizeof(struct TileCache));
+    if (!cache) return NULL;
+    cache->directory = strdup(directory);
+    cache->budget = budget;
+    atomic_init(&cache->bytes, 0);
+    atomic_init(&cache->temporaries, 0);
+    atomic_init(&cache->evicting, 0);
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    atomic_init(&cache->stored, 0);
+    atomic_init(&cache->evicted, 0);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/lock", directory);
+    cache->lock = cache->directory ? open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+    if (cache->lock < 0) {
+        free(cache->directory);
+        free(cache);
+        return NULL;
+    }
+
+    atomic_store(&cache->bytes, scanTileCache(cache, -1));
+    if (atomic_load(&cache->bytes) > budget) evictTiles(cache);
+    return cache;
+}
+
+void closeTileCache(struct TileCache *cache) {
+    if (!cache) return;
+    close(cache->lock);
+    free(cache->directory);
+    free(cache);
+}
+
+/*
+ * Tiles
+ */
+
+/*
+ * Load the k values of a tile of a frame from the
+ * cache, folding their minimum into min. Returns 0,
+ * or -1 if the tile is not in the cache.
+ */
+int loadCachedTile(struct TileCache *cache, struct Frame *frame, struct Tile tile, int *min) {
+    struct TileKey key = tileKey(frame, tile);
+    char path[4096];
+    tilePath(cache, &key, path, sizeof(path));
+
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        atomic_fetch_add(&cache->misses, 1);
+        return -1;
+    }
+    struct stat status;
+    void *mapped = MAP_FAILED;
+    if (fstat(file, &status) == 0 && status.st_size == fileBytes(&key)) {
+        mapped = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    if (mapped == MAP_FAILED || memcmp(mapped, &key, sizeof(key)) != 0) {
+        if (mapped != MAP_FAILED) munmap(mapped, status.st_size);
+        close(file);
+        atomic_fetch_add(&cache->misses, 1);
+        return -1;
+    }
+
+    // Copy the rows straight out of the mapping
+    const unsigned short *k = (const unsigned short*) ((const char*) mapped + sizeof(key));
+    int lowest = *min;
+    for (int i = 0; i < tile.h; i++) {
+        unsigned short *row = &FRAME_K(frame, tile.x, tile.y + i);
+        memcpy(row, k + i*tile.w, tile.w * sizeof(unsigned short));
+        for (int r = 0; r < tile.w; r++) {
+            if (row[r] < lowest) lowest = row[r];
+        }
+    }
+    *min = lowest;
+
+    munmap(mapped, status.st_size);
+    futimens(file, NULL); // Mark as recently used
+    close(file);
+    atomic_fetch_add(&cache->hits, 1);
+    return 0;
+}
+
+/*
+ * Store the k values of a fully rendered tile of a
+ * frame in the cache. Failing to is not an error;
+ * the tile is just rendered again next time.
+ */
+void storeCachedTile(struct TileCache *cache, struct Frame *frame, struct Tile tile) {
+    struct TileKey key = tileKey(frame, tile);
+    long bytes = fileBytes(&key);
+    char *data = malloc(bytes);
+    if (!data) return;
+    memcpy(data, &key, sizeof(key));
+    unsigned short *k = (unsigned short*) (data + sizeof(key));
+    for (int i = 0; i < tile.h; i++) {
+        memcpy(k + i*tile.w, &FRAME_K(frame, tile.x, tile.y + i), tile.w * sizeof(unsigned short));
+    }
+
+    // Write under a name of its own, then move it into place
+    char path[4096];
+    char temporary[4096];
+    tilePath(cache, &key, path, sizeof(path));
+    snprintf(
+        temporary, sizeof(temporary), "%s/.%ld.%ld.tmp",
+        cache->directory, (long) getpid(), atomic_fetch_add(&cache->temporaries, 1)
+    );
+    int file = open(temporary, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (file >= 0) {
+        // Flushed before the rename, so that a crash cannot leave a
+        // tile in place whose k values never reached the disk
+        int written = write(file, data, bytes) == bytes && fsync(file) == 0;
+        close(file);
+        if (written && rename(temporary, path) == 0) {
+            atomic_fetch_add(&cache->stored, 1);
+            if (atomic_fetch_add(&cache->bytes, bytes) + bytes > cache->budget) evictTiles(cache);
+        } else {
+            unlink(temporary);
+        }
+    }
+    free(data);
+}
@@ -0,0 +1,63 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <stdatomic.h>
+
+#include "frame.h"
+
+/*
+ * Tile Cache
+ *
+ * Keeps the k values of rendered tiles on disk, so
+ * that tiles rendered before (by this process or any
+ * other, now or in an earlier run) are loaded rather
+ * than rendered again.
+ *
+ * Each tile is a file in the cache directory, named
+ * after a hash of what determines its k values: the
+ * formula, the precision and the iteration cap, the
+ * coordinates of its first point, the gap between
+ * points and its size. The coordinates are snapped
+ * to a grid 1/256 of the gap apart, and the gap to 32
+ * significant bits, so that a tile reached along
+ * another route (its coordinates worked out with
+ * different rounding) is still found; tiles less than
+ * 1/512 of a gap apart are taken to be the same. The
+ * grid only snaps away rounding: tiles are laid out
+ * from each frame's own origin, so a frame shifted by
+ * a fraction of a tile shares none of them.
+ *
+ * The file repeats the key ahead of the k values, row
+ * by row, so a hash collision is a miss. Files are
+ * mapped to be read, written under a temporary name,
+ * flushed to disk and renamed into place, so processes
+ * sharing the directory (or starting up after a crash)
+ * never see half-written tiles. When the files take more than
+ * the budget, the least recently used are deleted,
+ * by one process at a time.
+ */
+
+// Bumped whenever the formula, the key or the file layout changes.
+#define TILE_CACHE_VERSION 2
+
+struct TileCache {
+    char *directory;
+    long budget;       // Bytes the files may take.
+    int lock;          // File descriptor of the lock file, taken while evicting.
+    atomic_long bytes; // Bytes the files take, as last counted plus since.
+    atomic_long temporaries; // Temporary files named so far.
+    atomic_int evicting;     // Whether a thread of this process is evicting.
+
+    atomic_long hits;
+    atomic_long misses;
+    atomic_long stored;
+    atomic_long evicted;
+};
+
+struct TileCache* openTileCache(const char*, long);
+void closeTileCache(struct TileCache*);
+char* defaultTileCacheDirectory();
+int loadCachedTile(struct TileCache*, struct Frame*, struct Tile, int*);
+void storeCachedTile(struct TileCache*, struct Frame*, struct Tile);
+
+#endif